@@ -0,0 +1,200 @@
+#include <iostream>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <cstring>
+#include "chunked_mesh.h"
+#include "model.h"
+#include "texture_cache.h"
+
+const uint32_t chunk_file_version = 1;
+
+// file layout: header, index of count MeshChunk, then the chunks as asset pack images aligned to pack_alignment
+struct ChunkFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t tangent_space;
+    double bounds[6]; // min xyz, max xyz
+};
+
+// median splits of the face centroids along the longest axis of their bounds until every range fits,
+// so that the ranges come out in a spatially coherent order
+static void split_faces(const std::vector<glm::dvec3>& centroids, std::vector<int>& faces, int begin, int end, int max_faces, std::vector<std::pair<int, int>>& ranges) {
+    if (end - begin <= max_faces) {
+        ranges.push_back({ begin, end });
+        return;
+    }
+    glm::dvec3 lo(std::numeric_limits<double>::max()), hi(-std::numeric_limits<double>::max());
+    for (int i = begin; i < end; i++) {
+        lo = glm::min(lo, centroids[faces[i]]);
+        hi = glm::max(hi, centroids[faces[i]]);
+    }
+    glm::dvec3 extent = hi - lo;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    int mid = begin + (end - begin) / 2;
+    std::nth_element(faces.begin() + begin, faces.begin() + mid, faces.begin() + end,
+        [&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+    split_faces(centroids, faces, begin, mid, max_faces, ranges);
+    split_faces(centroids, faces, mid, end, max_faces, ranges);
+}
+
+ChunkedMesh::ChunkedMesh() : tangent_space_(false), budget_(0), resident_bytes_(0), loads_(0) {}
+
+ChunkedMesh::~ChunkedMesh() {}
+
+// each chunk is a sub-model packed without its maps, written as soon as it is built
+bool ChunkedMesh::write(Model& model, const char* filename, int max_faces) {
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    std::vector<glm::dvec3> centroids(model.nfaces());
+    std::vector<int> faces(model.nfaces());
+    for (int f = 0; f < model.nfaces(); f++) {
+        glm::uvec3 idx = model.face(f);
+        centroids[f] = (model.vert(idx[0]) + model.vert(idx[1]) + model.vert(idx[2])) / 3.0;
+        faces[f] = f;
+    }
+    std::vector<std::pair<int, int>> ranges;
+    if (!faces.empty()) split_faces(centroids, faces, 0, (int)faces.size(), std::max(max_faces, 1), ranges);
+
+    ChunkFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "MCHK", 4);
+    header.version = chunk_file_version;
+    header.count = (uint32_t)ranges.size();
+    header.tangent_space = model.tangent_space();
+    for (int i = 0; i < 3; i++) {
+        header.bounds[i] = model.bounds_min()[i];
+        header.bounds[3 + i] = model.bounds_max()[i];
+    }
+    std::vector<MeshChunk> index(ranges.size());
+    uint64_t offset = sizeof(header) + index.size() * sizeof(MeshChunk);
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)index.data(), index.size() * sizeof(MeshChunk));
+
+    std::vector<unsigned char> image;
+    for (size_t c = 0; c < ranges.size(); c++) {
+        Model chunk(model, std::vector<int>(faces.begin() + ranges[c].first, faces.begin() + ranges[c].second));
+        chunk.pack(image, false);
+        glm::dvec3 center = (chunk.bounds_min() + chunk.bounds_max()) * 0.5;
+        double radius = 0.0;
+        for (int i = 0; i < chunk.nverts(); i++) radius = std::max(radius, glm::length(chunk.vert(i) - center));
+
+        uint64_t padding = (pack_alignment - offset % pack_alignment) % pack_alignment;
+        static const char zeros[pack_alignment] = {};
+        out.write(zeros, padding);
+        offset += padding;
+        index[c] = { glm::dvec4(center, radius), offset, image.size(), (uint32_t)chunk.nfaces(), 0 };
+        out.write((const char*)image.data(), image.size());
+        offset += image.size();
+    }
+    out.seekp(sizeof(header));
+    out.write((const char*)index.data(), index.size() * sizeof(MeshChunk));
+    if (!out.good()) {
+        std::cerr << "can't dump the chunked mesh\n";
+        return false;
+    }
+    std::cerr << "# chunked mesh " << filename << " chunks " << ranges.size() << " " << offset / 1024 << "KB" << std::endl;
+    return true;
+}
+
+// only the header and the index are read here
+bool ChunkedMesh::open(const char* filename, const char* obj_filename, int texture_level) {
+    lru_.clear();
+    resident_bytes_ = 0;
+    file_.close();
+    file_.open(filename, std::ios::binary);
+    ChunkFileHeader header;
+    if (!file_.is_open() || !file_.read((char*)&header, sizeof(header))) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    if (memcmp(header.magic, "MCHK", 4) || header.version != chunk_file_version) {
+        std::cerr << "bad chunked mesh " << filename << "\n";
+        return false;
+    }
+    index_.resize(header.count);
+    if (!file_.read((char*)index_.data(), index_.size() * sizeof(MeshChunk))) {
+        std::cerr << "bad chunked mesh " << filename << "\n";
+        index_.clear();
+        return false;
+    }
+    slots_.assign(index_.size(), lru_.end());
+    tangent_space_ = header.tangent_space;
+    bounds_[0] = glm::dvec3(header.bounds[0], header.bounds[1], header.bounds[2]);
+    bounds_[1] = glm::dvec3(header.bounds[3], header.bounds[4], header.bounds[5]);
+
+    std::string name(obj_filename);
+    size_t dot = name.find_last_of(".");
+    const char* suffixes[4] = { "_diffuse.tga", tangent_space_ ? "_nm_tangent.tga" : "_nm.tga", "_spec.tga", "_glow.tga" };
+    for (int i = 0; i < 4; i++) {
+        maps_[i] = dot == std::string::npos ? std::make_shared<Texture>() : TextureCache::instance().get(name.substr(0, dot) + suffixes[i], texture_level);
+    }
+    std::cerr << "# chunked mesh " << filename << " chunks " << index_.size() << std::endl;
+    return true;
+}
+
+int ChunkedMesh::nchunks() {
+    return (int)index_.size();
+}
+
+const MeshChunk& ChunkedMesh::chunk(int i) {
+    return index_[i];
+}
+
+bool ChunkedMesh::tangent_space() {
+    return tangent_space_;
+}
+
+glm::dvec3 ChunkedMesh::bounds_min() {
+    return bounds_[0];
+}
+
+glm::dvec3 ChunkedMesh::bounds_max() {
+    return bounds_[1];
+}
+
+void ChunkedMesh::set_budget(size_t bytes) {
+    budget_ = bytes;
+}
+
+// the least recently drawn chunks are dropped first to make room
+Model* ChunkedMesh::acquire(int i) {
+    if (slots_[i] != lru_.end()) {
+        lru_.splice(lru_.begin(), lru_, slots_[i]);
+        return lru_.front().model.get();
+    }
+    const MeshChunk& c = index_[i];
+    while (!lru_.empty() && resident_bytes_ + c.bytes > budget_) {
+        resident_bytes_ -= index_[lru_.back().chunk].bytes;
+        slots_[lru_.back().chunk] = lru_.end();
+        lru_.pop_back();
+    }
+    std::vector<unsigned char> image(c.bytes);
+    file_.clear();
+    if (!file_.seekg(c.offset) || !file_.read((char*)image.data(), image.size())) {
+        std::cerr << "can't read chunk " << i << "\n";
+        image.clear();
+    }
+    std::unique_ptr<Model> model(new Model(std::move(image)));
+    model->diffusemap = maps_[0];
+    model->normalmap = maps_[1];
+    model->specularmap = maps_[2];
+    model->glowmap = maps_[3];
+    lru_.push_front({ i, std::move(model) });
+    slots_[i] = lru_.begin();
+    resident_bytes_ += c.bytes;
+    loads_++;
+    return lru_.front().model.get();
+}
+
+size_t ChunkedMesh::resident_bytes() {
+    return resident_bytes_;
+}
+
+int ChunkedMesh::loads() {
+    return loads_;
+}
@@ -0,0 +1,61 @@
+#ifndef __CHUNKED_MESH_H__
+#define __CHUNKED_MESH_H__
+
+#include <vector>
+#include <list>
+#include <memory>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "texture.h"
+
+class Model;
+
+// entry of the resident index: where a chunk lives in the file and what it covers
+struct MeshChunk {
+    glm::dvec4 sphere; // bounding sphere: center, radius
+    uint64_t offset;   // asset pack image of the chunk, see Model::pack()
+    uint64_t bytes;
+    uint32_t faces;
+    uint32_t pad;
+};
+
+// mesh split into spatially coherent chunks stored one after the other in a file. only the index stays in memory,
+// chunks are read when drawn and kept in a window of bounded size, the least recently drawn going first
+class ChunkedMesh {
+private:
+    std::ifstream file_;
+    std::vector<MeshChunk> index_;
+    bool tangent_space_;
+    glm::dvec3 bounds_[2];
+    std::shared_ptr<Texture> maps_[4]; // diffuse, normal, specular, glow, shared by every chunk
+    size_t budget_;
+    size_t resident_bytes_;
+    struct Entry {
+        int chunk;
+        std::unique_ptr<Model> model;
+    };
+    std::list<Entry> lru_;                         // resident chunks, most recently drawn first
+    std::vector<std::list<Entry>::iterator> slots_; // per chunk, lru_.end() when not resident
+    int loads_;
+
+public:
+    ChunkedMesh();
+    ~ChunkedMesh();
+    // splits model so that no chunk holds more than max_faces faces. model may be loaded geometry_only, see Model()
+    static bool write(Model& model, const char* filename, int max_faces);
+    // the maps are taken from the texture cache, named after obj_filename as Model does
+    bool open(const char* filename, const char* obj_filename, int texture_level = 0);
+    int nchunks();
+    const MeshChunk& chunk(int i);
+    bool tangent_space();
+    glm::dvec3 bounds_min();
+    glm::dvec3 bounds_max();
+    void set_budget(size_t bytes); // bytes of chunks kept in memory, the chunk being drawn is always kept
+    Model* acquire(int i);         // reads the chunk if it isn't resident, valid until chunks totalling the budget are acquired
+    size_t resident_bytes();
+    int loads();                   // chunks read from the file so far
+};
+
+#endif //__CHUNKED_MESH_H__
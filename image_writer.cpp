@@ -0,0 +1,68 @@
+#include <algorithm>
+#include "image_writer.h"
+
+ImageWriter::ImageWriter(int frames) : frames_(std::max(frames, 2)), writing_(0), failures_(0), stopping_(false) {
+    thread_ = std::thread(&ImageWriter::work, this);
+}
+
+ImageWriter::~ImageWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    changed_.notify_all();
+    thread_.join();
+}
+
+void ImageWriter::work() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            changed_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) return;
+            job = std::move(queue_.front());
+            queue_.pop_front();
+            writing_++;
+        }
+        bool written = job.image.write_file(job.filename.c_str());
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!written) failures_++;
+            free_.push_back(std::move(job.image));
+            writing_--;
+        }
+        changed_.notify_all();
+    }
+}
+
+TGAImage ImageWriter::acquire(int w, int h, int bpp) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < free_.size(); i++) {
+            if (free_[i].get_width() == w && free_[i].get_height() == h && free_[i].get_bytespp() == bpp) {
+                TGAImage image(std::move(free_[i]));
+                free_.erase(free_.begin() + i);
+                image.clear();
+                return image;
+            }
+        }
+    }
+    return TGAImage(w, h, bpp);
+}
+
+void ImageWriter::submit(TGAImage& image, const std::string& filename) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this] { return (int)queue_.size() + writing_ < frames_ - 1; });
+    queue_.push_back({ std::move(image), filename });
+    lock.unlock();
+    changed_.notify_all();
+}
+
+bool ImageWriter::finish() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this] { return queue_.empty() && !writing_; });
+    bool ok = !failures_;
+    failures_ = 0;
+    return ok;
+}
@@ -0,0 +1,43 @@
+#ifndef __IMAGE_WRITER_H__
+#define __IMAGE_WRITER_H__
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "tgaimage.h"
+
+// finished render targets are handed to a background thread that writes them while the next one is drawn.
+// at most frames buffers are in use: the one being drawn, the others queued or being written. written buffers
+// are kept and handed out again
+class ImageWriter {
+private:
+    struct Job {
+        TGAImage image;
+        std::string filename;
+    };
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::deque<Job> queue_;
+    std::vector<TGAImage> free_;
+    int frames_;
+    int writing_; // jobs taken off the queue and not written yet
+    int failures_;
+    bool stopping_;
+    void work();
+
+public:
+    ImageWriter(int frames = 2);
+    ~ImageWriter(); // writes what is queued first
+    ImageWriter(const ImageWriter&) = delete;
+    ImageWriter& operator =(const ImageWriter&) = delete;
+    TGAImage acquire(int w, int h, int bpp); // cleared, reusing a written buffer of the same size when there is one
+    // takes over the pixels of image, leaving it empty. waits while frames - 1 images are queued or being written
+    void submit(TGAImage& image, const std::string& filename);
+    bool finish(); // waits for every submitted image, false if any couldn't be written
+};
+
+#endif //__IMAGE_WRITER_H__
@@ -3,14 +3,23 @@
 #include <cstdlib>
 #include <cstring>
 #include <limits>
+#include <string>
+#include <filesystem>
+#include <functional>
 #include "our_gl.h"
 #include "tgaimage.h"
 #include "model.h"
+#include "texture_cache.h"
+#include "chunked_mesh.h"
+#include "scene.h"
+#include "image_writer.h"
 #include <glm/gtc/matrix_access.hpp>
 
 const TGAColor white = TGAColor(255, 255, 255, 255);
 const TGAColor red = TGAColor(255, 0, 0, 255);
-Model* model = NULL;
+Model* model = NULL; // model of the instance being drawn
+ChunkedMesh* chunks = NULL;
+Scene* scene = NULL;
 double* shadow_buffer = NULL;
 const int width = 800;
 const int height = 800;
@@ -23,6 +32,25 @@ const double kd = 0.6;
 const double ke = 5.0;
 const double gamma = 1.25;
 const double bloom_threshold = 0.75;
+const Sampler::Filter texture_filter = Sampler::NEAREST; // BILINEAR or TRILINEAR filter the maps and pick mip levels, at a cost per fragment
+const bool tangent_space_normals = false; // for models shipping a _nm_tangent.tga map
+const bool interleave_materials = false; // packs the four maps into one texture read with a single fetch, normals stored octahedral
+const bool compress_textures = false; // takes precedence over interleaving
+const bool octahedral_normals = false; // without interleaving or compression, decodes normal maps once into octahedral unit vectors
+const size_t texture_cache_budget = 256u << 20; // bytes of textures kept loaded for reuse once no model holds them
+const int texture_level = 0; // mip level the maps start at, 1 halves their resolution
+const bool use_asset_pack = false; // loads <model>.pack, written from the obj and its textures when missing or older
+const bool virtual_texturing = false; // maps stay sparse in tile files, read as a feedback pass asks for them. the maps are then used as they are, normal maps as RGB
+const bool stream_chunks = false; // for a single model, streams <model>.chunks, written from the obj when missing or older, through a window of chunk_window bytes. the maps are then used as they are
+const size_t chunk_window = 64u << 20;
+const int chunk_faces = 1 << 14; // most faces in a chunk
+const bool use_lods = false; // simplifies the model into a lod chain and draws the coarsest lod whose error stays under lod_pixel_error on screen
+const double lod_pixel_error = 0.5;
+
+// output, the extensions pick the formats: .tga, .qoi, .ppm, .pgm or .pfm
+const char* const depth_file = "depth.tga";
+const char* const output_file = "output.tga";
+const char* const depth_map_file = NULL; // the shadow buffer as a pfm of depths in [0, 1], without the 8 bit quantization of depth_file
 
 // scene var
 glm::dvec3 camera_pos(2, 2, 5);
@@ -30,6 +58,10 @@ glm::dvec3 light_dir(1, 1, 1);
 glm::dvec3 light_pos(0, 1, 1);
 glm::dvec3 camera_eye(0, 0, 0);
 
+// submission order of each pass
+const DepthOrder depth_pass_order = FRONT_TO_BACK;
+const DepthOrder main_pass_order = FRONT_TO_BACK;
+
 // printing
 void printDVec3(const glm::dvec3& vec) {
     std::cout << "glm::dvec3(" << vec.x << ", " << vec.y << ", " << vec.z  << ")" << std::endl;
@@ -53,26 +85,173 @@ void printDMat4(const glm::dmat4& mat) {
     }
 }
 
-// shader for building shadow buffer
-struct DepthShader : public IShader {
-    glm::dmat3 varying_tri;
+// faces of the meshlets surviving culling, in the order they are submitted to triangle().
+// meshlets are sorted as clusters by the view-space depth of their bounding sphere centers.
+std::vector<int> visible_faces(DepthOrder order, bool cull_backfaces) {
+    std::vector<int> clusters;
+    std::vector<double> depths;
+    for (int i = 0; i < model->nmeshlets(); i++) {
+        const Meshlet& m = model->meshlet(i);
+        if (!cluster_visible(m.sphere, m.cone, width, height, cull_backfaces)) continue;
+        clusters.push_back(i);
+        depths.push_back(order == UNSORTED ? 0.0 : (ModelView_mat * glm::dvec4(glm::dvec3(m.sphere), 1.0)).z);
+    }
+    std::vector<int> sorted;
+    depth_sort(depths, order, sorted);
 
-    DepthShader() : varying_tri() {}
+    std::vector<int> faces;
+    for (int k : sorted) {
+        const Meshlet& m = model->meshlet(clusters[k]);
+        for (int i = m.face_offset; i < m.face_offset + m.face_count; i++) faces.push_back(model->meshlet_face(i));
+    }
+    return faces;
+}
 
-    virtual glm::dvec3 vertex(int iface, int nthvert) {
-        // rasterize
-        glm::dvec3 v = model->vert(model->face(iface)[nthvert]);
+// coarsest lod whose simplification error, projected at the center of the model, stays under lod_pixel_error
+int select_lod() {
+    glm::dvec3 center = (model->bounds_min() + model->bounds_max()) * 0.5;
+    glm::dvec3 right = glm::normalize(glm::dvec3(glm::row(ModelView_mat, 0))); // object-space direction of screen x
+    glm::dmat4 M = Viewport_mat * Projection_mat * ModelView_mat;
+    glm::dvec4 a = M * glm::dvec4(center, 1.0), b = M * glm::dvec4(center + right, 1.0);
+    double pixels_per_unit = glm::length(glm::dvec2(b) / b.w - glm::dvec2(a) / a.w);
+    int lod = 0;
+    for (int l = 1; l < model->nlods(); l++) {
+        if (model->lod_error(l) * pixels_per_unit < lod_pixel_error) lod = l;
+    }
+    return lod;
+}
+
+// post-transform cache: screen positions of the vertices of the instance being drawn, each one transformed once
+// however many faces share it. begin() takes the matrices of the instance
+struct VertexCache {
+    glm::dmat4 uniform_MVP;
+    std::vector<glm::dvec3> screen;
+    std::vector<unsigned> stamp;
+    unsigned generation = 0;
+
+    void begin(int nverts) {
+        uniform_MVP = Viewport_mat * Projection_mat * ModelView_mat;
+        if ((int)stamp.size() < nverts) {
+            stamp.resize(nverts, 0);
+            screen.resize(nverts);
+        }
+        if (++generation == 0) {
+            std::fill(stamp.begin(), stamp.end(), 0);
+            generation = 1;
+        }
+    }
+
+    glm::dvec3 vertex(int i) {
+        if (stamp[i] == generation) return screen[i];
+        glm::dvec3 v = model->vert(i);
         glm::dvec4 aug_coords(v.x, v.y, v.z, 1.0);
-        glm::dvec4 aug_mat = Viewport_mat * Projection_mat * ModelView_mat * aug_coords;
+        glm::dvec4 aug_mat = uniform_MVP * aug_coords;
 
         // make smoother result
         glm::dvec3 result;
         result.x = int(aug_mat[0] / aug_mat[3]);
         result.y = int(aug_mat[1] / aug_mat[3]);
         result.z = aug_mat[2] / aug_mat[3];
+        stamp[i] = generation;
+        screen[i] = result;
+        return result;
+    }
+};
+VertexCache post_transform;
+
+// with a chunked mesh the chunks surviving frustum culling are sorted like meshlets, then each one in turn
+// is made resident and becomes the model draw reads. otherwise draw runs once on the model
+void draw_chunks(DepthOrder order, const std::function<void()>& draw) {
+    if (!chunks) {
+        draw();
+        return;
+    }
+    std::vector<int> visible;
+    std::vector<double> depths;
+    for (int i = 0; i < chunks->nchunks(); i++) {
+        const MeshChunk& c = chunks->chunk(i);
+        if (!cluster_visible(c.sphere, glm::dvec4(0.0, 0.0, 0.0, 2.0), width, height, false)) continue;
+        visible.push_back(i);
+        depths.push_back(order == UNSORTED ? 0.0 : (ModelView_mat * glm::dvec4(glm::dvec3(c.sphere), 1.0)).z);
+    }
+    std::vector<int> sorted;
+    depth_sort(depths, order, sorted);
+    for (int k : sorted) {
+        model = chunks->acquire(visible[k]);
+        post_transform.begin(model->nverts());
+        draw();
+    }
+    model = NULL;
+}
+
+// instances culled against the frustum by the bounds of their model and sorted like meshlets. each one in turn
+// becomes the model, with the modelview composing view with its transform, and draw runs on it.
+// a streamed mesh is drawn chunk by chunk instead
+void draw_instances(const glm::dmat4& view, DepthOrder order, const std::function<void()>& draw) {
+    if (chunks) {
+        ModelView_mat = view;
+        draw_chunks(order, draw);
+        return;
+    }
+    std::vector<int> visible;
+    std::vector<double> depths;
+    for (int i = 0; i < (int)scene->instances.size(); i++) {
+        const Instance& instance = scene->instances[i];
+        Model* m = scene->models[instance.model].model.get();
+        if (!m->nfaces()) continue;
+        ModelView_mat = view * instance.transform;
+        glm::dvec3 center = (m->bounds_min() + m->bounds_max()) * 0.5;
+        glm::dvec4 sphere(center, glm::length(m->bounds_max() - center));
+        if (!cluster_visible(sphere, glm::dvec4(0.0, 0.0, 0.0, 2.0), width, height, false)) continue;
+        visible.push_back(i);
+        depths.push_back(order == UNSORTED ? 0.0 : (ModelView_mat * glm::dvec4(center, 1.0)).z);
+    }
+    std::vector<int> sorted;
+    depth_sort(depths, order, sorted);
+    for (int k : sorted) {
+        const Instance& instance = scene->instances[visible[k]];
+        model = scene->models[instance.model].model.get();
+        ModelView_mat = view * instance.transform;
+        model->set_lod(instance.lod);
+        post_transform.begin(model->nverts());
+        draw();
+    }
+    ModelView_mat = view;
+    model = NULL;
+}
+
+// loads <path>.obj, or the asset pack made from it, prepared as the options ask.
+// a pack that can't be read, of an older version or damaged, is made again from the obj
+Model* load_model(const std::string& path) {
+    std::string obj = path + ".obj";
+    std::string pack = path + ".pack";
+    std::error_code ec;
+    if (use_asset_pack && std::filesystem::exists(pack, ec) &&
+        std::filesystem::last_write_time(pack, ec) >= std::filesystem::last_write_time(obj, ec)) {
+        Model* m = new Model(pack.c_str());
+        if (m->ok()) return m;
+        delete m;
+        std::cerr << "# rebuilding asset pack " << pack << std::endl;
+    }
+    Model* m = new Model(obj.c_str(), tangent_space_normals, virtual_texturing, texture_level);
+    if (compress_textures) m->compress_textures();
+    else if (interleave_materials) m->interleave_materials();
+    else if (octahedral_normals) m->encode_normals();
+    if (use_lods) m->build_lods();
+    if (use_asset_pack) m->write_pack(pack.c_str());
+    return m;
+}
+
+// shader for building shadow buffer
+struct DepthShader : public IShader {
+    glm::dmat3 varying_tri;
 
+    DepthShader() : varying_tri() {}
+
+    virtual glm::dvec3 vertex(int iface, int nthvert) {
+        // rasterize
+        glm::dvec3 result = post_transform.vertex(model->face(iface)[nthvert]);
         varying_tri[nthvert] = result;
-             
         return result;
     }
 
@@ -89,83 +268,64 @@ struct GouraudShader : public IShader {
     glm::dmat3 varying_uvCoords;
     glm::dmat3 varying_fragPos;
     glm::dmat3 varying_normal;
+    glm::dmat2 varying_duv; // uv derivatives along screen x and y, for mip selection
     glm::dmat4 uniform_M;
     glm::dmat4 uniform_invM;
     glm::dmat4 uniform_shadowM; // transform framebuffer screen coordinates to shadowbuffer screen coordinates
+    glm::dvec3 uniform_light;   // light direction after projection
+
+    Sampler sampler;
 
-    GouraudShader() {}
+    GouraudShader() : sampler(texture_filter) {}
 
     virtual glm::dvec3 vertex(int iface, int nthvert) override {
         varying_normal[nthvert] = glm::normalize(glm::dvec3(uniform_invM * glm::dvec4(model->normal(iface, nthvert), 0.0)));
         varying_uvCoords[nthvert] = model->vert_texture(model->vert_texture_idx(iface)[nthvert]);
         
         // rasterize
-        glm::dvec3 v = model->vert(model->face(iface)[nthvert]);
-        glm::dvec4 aug_coords(v.x, v.y, v.z, 1.0);
-        glm::dvec4 aug_mat = Viewport_mat * Projection_mat * ModelView_mat * aug_coords;
-
-        // make smoother result
-        glm::dvec3 result;
-        result.x = int(aug_mat[0] / aug_mat[3]);
-        result.y = int(aug_mat[1] / aug_mat[3]);
-        result.z = aug_mat[2] / aug_mat[3];
+        glm::dvec3 result = post_transform.vertex(model->face(iface)[nthvert]);
 
         // variables
         varying_fragPos[nthvert] = result;
         varying_view = glm::normalize(camera_pos - varying_fragPos[nthvert]);
+        if (nthvert == 2) varying_duv = uv_gradient(varying_fragPos, varying_uvCoords);
         return result;
     }
 
+    // normal from the object-space map
+    virtual glm::dvec3 shading_normal(glm::dvec3 baryCoord, const Material& mat) {
+        return glm::normalize(glm::dvec3(uniform_invM * glm::dvec4(mat.normal, 0.0)));
+    }
+
     virtual bool fragment(glm::dvec3 baryCoord, TGAColor& color) override {
         glm::dvec3 uv = varying_uvCoords * baryCoord;
+        Material mat = model->material(sampler, uv, varying_duv);
 
         // shadow mapping
         glm::dvec4 shadow_point = uniform_shadowM * glm::dvec4(varying_fragPos * baryCoord, 1.0); // corresponding point in the shadow buffer
         shadow_point = shadow_point / shadow_point[3];
-        int idx = int(shadow_point[0]) + int(shadow_point[1]) * width; // index in the shadowbuffer array
-        double shadow = 0.3 + 0.7 * (shadow_buffer[idx] < shadow_point[2] + 43.34); // only render front pixels & magic coeff to avoid z-fighting
-
-        // normal from map
-        TGAColor nm_color = model->normalmap.get((int)(uv[0] * model->normalmap.get_width()), (int)(uv[1] * model->normalmap.get_height()));
-        glm::dvec3 norm;
-        for (int i = 0; i < 3; i++) {
-            norm[2 - i] = (double)nm_color[i] / 255.0 * 2.0 - 1.0;
+        double shadow = 1.0; // points outside the light's viewport are lit
+        if (shadow_point[0] >= 0.0 && shadow_point[0] < width && shadow_point[1] >= 0.0 && shadow_point[1] < height) {
+            int idx = int(shadow_point[0]) + int(shadow_point[1]) * width; // index in the shadowbuffer array
+            shadow = 0.3 + 0.7 * (shadow_buffer[idx] < shadow_point[2] + 43.34); // only render front pixels & magic coeff to avoid z-fighting
         }
-        glm::dvec3 n_map = glm::normalize(glm::dvec3(uniform_invM * glm::dvec4(norm, 0.0)));
 
         // normal and light vector
-        glm::dvec3 l = glm::normalize(glm::dvec3(uniform_M * glm::dvec4(light_dir, 0.0)));
-        glm::dvec3 bn = glm::normalize(varying_normal * baryCoord);
+        glm::dvec3 l = uniform_light;
+        glm::dvec3 n = shading_normal(baryCoord, mat);
 
-        // darboux basis
-        glm::dmat3 mat_A;
-        mat_A[0] = varying_fragPos[1] - varying_fragPos[0];
-        mat_A[1] = varying_fragPos[2] - varying_fragPos[0];
-        mat_A[2] = bn;
-        mat_A = glm::transpose(mat_A);
-
-        glm::dmat3 mat_AInv = glm::inverse(mat_A);
-        glm::dvec3 i = -mat_AInv * glm::dvec3(varying_uvCoords[1][0] - varying_uvCoords[0][0], varying_uvCoords[2][0] - varying_uvCoords[0][0], 0.0);
-        glm::dvec3 j = -mat_AInv * glm::dvec3(varying_uvCoords[1][1] - varying_uvCoords[0][1], varying_uvCoords[2][1] - varying_uvCoords[0][1], 0.0);
-
-        glm::dmat3 mat_B;
-        mat_B[0] = glm::normalize(i);
-        mat_B[1] = glm::normalize(j);
-        mat_B[2] = bn;
-        glm::dvec3 n = n_map;
-        
         // diffuse
-        TGAColor diffuse_color = model->diffusemap.get((int)(uv[0] * model->diffusemap.get_width()), (int)(uv[1] * model->diffusemap.get_height()));
+        TGAColor diffuse_color = mat.diffuse;
         double diffuse_intensity = std::max(0.0, glm::dot(n, l));
 
         // specular
-        TGAColor spec_color = model->specularmap.get((int)(uv[0] * model->specularmap.get_width()), (int)(uv[1] * model->specularmap.get_height()));
+        TGAColor spec_color = mat.specular;
         glm::dvec3 reflection = glm::normalize(glm::reflect(l, n));
         double cos_angle = glm::max(glm::dot(reflection, varying_view), 0.0);
         double spec_intensity = glm::pow(cos_angle, 5.0 + spec_color[0]/1.0);
 
         // emission = glow
-        TGAColor glow_color = model->glowmap.get((int)(uv[0] * model->glowmap.get_width()), (int)(uv[1] * model->glowmap.get_height()));
+        TGAColor glow_color = mat.glow;
         double glow_intensity = 0.0;
         double luminance = 0.2126 * glow_color[0] + 0.7152 * glow_color[1] + 0.0722 * glow_color[2];
         if (luminance > bloom_threshold) {
@@ -191,10 +351,66 @@ struct GouraudShader : public IShader {
     }
 };
 
+// same shading with a tangent-space normal map: the per-vertex tangent frames are interpolated and the
+// map's normal is taken into that frame
+struct TangentShader : public GouraudShader {
+    glm::dmat3 varying_tangent;
+    glm::dvec3 varying_sign; // bitangent signs
+
+    virtual glm::dvec3 vertex(int iface, int nthvert) override {
+        glm::dvec4 t = model->tangent(iface, nthvert);
+        varying_tangent[nthvert] = glm::dvec3(uniform_invM * glm::dvec4(glm::dvec3(t), 0.0)); // same space as the normal
+        varying_sign[nthvert] = t.w;
+        return GouraudShader::vertex(iface, nthvert);
+    }
+
+    virtual glm::dvec3 shading_normal(glm::dvec3 baryCoord, const Material& mat) override {
+        glm::dvec3 bn = glm::normalize(varying_normal * baryCoord);
+        glm::dvec3 t = varying_tangent * baryCoord;
+        t = glm::normalize(t - bn * glm::dot(bn, t));
+        glm::dvec3 b = glm::cross(bn, t) * (glm::dot(varying_sign, baryCoord) < 0.0 ? -1.0 : 1.0);
+        return glm::normalize(t * mat.normal.x + b * mat.normal.y + bn * mat.normal.z);
+    }
+};
+
+// virtual texturing feedback: samples the materials exactly as the shading pass will, so that every tile it misses
+// is requested, without doing any lighting
+struct FeedbackShader : public GouraudShader {
+    virtual bool fragment(glm::dvec3 baryCoord, TGAColor& color) override {
+        glm::dvec3 uv = varying_uvCoords * baryCoord;
+        model->material(sampler, uv, varying_duv);
+        return false;
+    }
+};
+
 int main(int argc, char** argv) {
     if (2 == argc) {
         std::cout << argv[1] << std::endl;
-        model = new Model(strcat(argv[1], ".obj"));
+        TextureCache::instance().set_budget(texture_cache_budget);
+        scene = new Scene();
+        std::string name(argv[1]);
+        if (name.size() > 6 && !name.compare(name.size() - 6, 6, ".scene")) {
+            scene->load(argv[1], load_model);
+        }
+        else if (stream_chunks) {
+            std::string obj = name + ".obj";
+            std::string chunked = name + ".chunks";
+            std::error_code ec;
+            if (!std::filesystem::exists(chunked, ec) || std::filesystem::last_write_time(chunked, ec) < std::filesystem::last_write_time(obj, ec)) {
+                // geometry only: no maps, tangents or meshlets are built for the whole model, chunks get their own
+                Model source(obj.c_str(), tangent_space_normals, false, 0, true);
+                ChunkedMesh::write(source, chunked.c_str(), chunk_faces);
+            }
+            chunks = new ChunkedMesh();
+            chunks->set_budget(chunk_window);
+            chunks->open(chunked.c_str(), obj.c_str(), texture_level);
+        }
+        else {
+            scene->add(load_model(name), name);
+        }
+        camera_pos = scene->camera_pos;
+        camera_eye = scene->camera_eye;
+        light_pos = scene->light_pos;
     }
     else {
         std::cout << "Too few args" << std::endl;
@@ -207,60 +423,122 @@ int main(int argc, char** argv) {
     // buffer
     double* zbuffer = new double[(width * height)];
     shadow_buffer = new double[(width * height)];
-    for (int i = width * height; --i;) {
+    for (int i = width * height; i--;) {
         zbuffer[i] = shadow_buffer[i] = -std::numeric_limits<float>::max();
     }
 
+    // lods are picked for the camera and kept for both passes, so that shadows fall on the surface drawn
+    if (use_lods) {
+        projection(-1.0 / camera_pos.z);
+        viewport(static_cast<double>(width) / 8.0, static_cast<double>(height) / 8.0, static_cast<double>(width) * 0.75, static_cast<double>(height) * 0.75, depth);
+        lookAt(camera_eye, camera_pos, glm::dvec3(0.0, 1.0, 0.0));
+        glm::dmat4 view = ModelView_mat;
+        for (Instance& instance : scene->instances) {
+            model = scene->models[instance.model].model.get();
+            ModelView_mat = view * instance.transform;
+            instance.lod = select_lod();
+            model->set_lod(instance.lod);
+            std::cerr << "# lod faces " << model->nfaces() << std::endl;
+        }
+        ModelView_mat = view;
+        model = NULL;
+    }
+
+    // finished images are written in the background while the next pass is drawn
+    ImageWriter writer;
+
     // building and rendering the shadow buffer
     { 
-        TGAImage depthImage(width, height, TGAImage::RGB);
+        TGAImage depthImage = writer.acquire(width, height, TGAImage::RGB);
         depthImage.flip_vertically(); // to place the origin in the bottom left corner of the image
         lookAt(camera_eye, light_pos, glm::dvec3(0.0, 1.0, 0.0)); // modelview matrix
         viewport(static_cast<double>(width) / 8.0, static_cast<double>(height) / 8.0, static_cast<double>(width) * 0.75, static_cast<double>(height) * 0.75, depth);
         projection(0);
 
         DepthShader depthshader;
-        for (int i = 0; i < model->nfaces(); i++) {
-            glm::dvec3 pts[3];
-            for (int j = 0; j < 3; j++) {
-                pts[j] = depthshader.vertex(i, j);
+        draw_instances(ModelView_mat, depth_pass_order, [&]() {
+            for (int i : visible_faces(depth_pass_order, true)) {
+                glm::dvec3 pts[3];
+                for (int j = 0; j < 3; j++) {
+                    pts[j] = depthshader.vertex(i, j);
+                }
+                triangle(pts, depthshader, depthImage, shadow_buffer);
+            }
+        });
+        writer.submit(depthImage, depth_file);
+        if (depth_map_file) {
+            std::vector<float> depths(width * height, 0.f); // nothing drawn is as far as the depth image's black
+            for (int i = 0; i < width * height; i++) {
+                if (shadow_buffer[i] > -std::numeric_limits<float>::max()) depths[i] = (float)(shadow_buffer[i] / depth);
             }
-            triangle(pts, depthshader, depthImage, shadow_buffer);
+            TGAImage::write_pfm_file(depth_map_file, depths.data(), width, height, 1);
         }
-        depthImage.write_tga_file("depth.tga");
     }
     
     glm::dmat4 shadow_model_view = Viewport_mat * Projection_mat * ModelView_mat;
 
     // main image rendering
     {
-        TGAImage outImage(width, height, TGAImage::RGB);
+        TGAImage outImage = writer.acquire(width, height, TGAImage::RGB);
         outImage.flip_vertically();
 
         // all transformation matrices
         projection(-1.0 / camera_pos.z); // projection matrix
         viewport(static_cast<double>(width) / 8.0, static_cast<double>(height) / 8.0, static_cast<double>(width) * 0.75, static_cast<double>(height) * 0.75, depth); // viewport matrix
         lookAt(camera_eye, camera_pos, glm::dvec3(0.0, 1.0, 0.0)); // modelview matrix
+        glm::dmat4 view = ModelView_mat;
+
+        // uniforms shared by every instance are computed once, the others when an instance is bound
+        glm::dmat4 shadowM = shadow_model_view * glm::inverse(Viewport_mat * Projection_mat * view); // screen space -> world space -> shadow screen space
+        glm::dvec3 light = glm::normalize(glm::dvec3(Projection_mat * view * glm::dvec4(light_dir, 0.0)));
+        GouraudShader object_space_shader;
+        TangentShader tangent_space_shader;
+        FeedbackShader feedbackshader;
+        auto bind = [&](GouraudShader& shader) -> GouraudShader& {
+            shader.uniform_shadowM = shadowM;
+            shader.uniform_light = light;
+            shader.uniform_M = Projection_mat * ModelView_mat;
+            shader.uniform_invM = glm::inverse(shader.uniform_M);
+            return shader;
+        };
+
+        // feedback pass into scratch buffers, then the requested tiles are made resident before shading
+        if (virtual_texturing && !chunks) {
+            TGAImage feedbackImage(width, height, TGAImage::RGB);
+            std::vector<double> feedback_zbuffer(width * height, -std::numeric_limits<float>::max());
+            draw_instances(view, main_pass_order, [&]() {
+                GouraudShader& shader = bind(feedbackshader);
+                for (int i : visible_faces(main_pass_order, true)) {
+                    glm::dvec3 pts[3];
+                    for (int j = 0; j < 3; j++) {
+                        pts[j] = shader.vertex(i, j);
+                    }
+                    triangle(pts, shader, feedbackImage, feedback_zbuffer.data());
+                }
+            });
+            int loaded = 0;
+            for (Scene::Entry& entry : scene->models) loaded += entry.model->resolve_feedback();
+            std::cerr << "# tiles loaded " << loaded << std::endl;
+        }
 
-        // populate face
-        GouraudShader shader;
-        shader.uniform_shadowM = shadow_model_view * glm::inverse(Viewport_mat * Projection_mat * ModelView_mat); // screen space -> object space -> shadow screen space 
-        shader.uniform_M = Projection_mat * ModelView_mat;
-        shader.uniform_invM = glm::inverse(shader.uniform_M);
-
-        for (int i = 0; i < model->nfaces(); i++) {
-            glm::dvec3 pts[3];
-            for (int j = 0; j < 3; j++) {
-                pts[j] = shader.vertex(i, j);
+        draw_instances(view, main_pass_order, [&]() {
+            GouraudShader& shader = bind(model->tangent_space() ? tangent_space_shader : object_space_shader);
+            for (int i : visible_faces(main_pass_order, true)) {
+                glm::dvec3 pts[3];
+                for (int j = 0; j < 3; j++) {
+                    pts[j] = shader.vertex(i, j);
+                }
+                triangle(pts, shader, outImage, zbuffer);
             }
-            triangle(pts, shader, outImage, zbuffer);
-        }
+        });
+        if (chunks) std::cerr << "# chunks read " << chunks->loads() << " resident " << chunks->resident_bytes() / 1024 << "KB" << std::endl;
 
-        outImage.write_tga_file("output.tga");
+        writer.submit(outImage, output_file);
     }
 
-    delete model;
+    delete scene;
+    delete chunks;
     delete[] zbuffer;
     delete[] shadow_buffer;
-    return 0;
+    return writer.finish() ? 0 : -1;
 }
@@ -1,71 +1,406 @@
 #include <iostream>
 #include <string>
 #include <fstream>
-#include <sstream>
 #include <vector>
+#include <charconv>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <unordered_map>
+#include <array>
+#include <numeric>
+#include <filesystem>
 #include "model.h"
+#include "texture_cache.h"
+#include "thread_pool.h"
+#include "mapped_file.h"
 
-const char vert_prefix[3] = "v ";
-const char face_prefix[3] = "f ";
-const char vert_texture_prefix[5] = "vt  ";
-const char normal_prefix[5] = "vn ";
-
-
-Model::Model(const char *filename) : verts_(), faces_() {
-    std::ifstream in;
-    in.open (filename, std::ifstream::in);
-    if (in.fail()) return;
-    std::string line;
-    while (!in.eof()) {
-        std::getline(in, line);
-        std::istringstream iss(line.c_str());
-        char trash;
-        if (!line.compare(0, 2, vert_prefix)) {
-            iss >> trash;
-            glm::dvec3 v;
-            for (int i=0;i<3;i++) iss >> v[i];
-            verts_.push_back(v);
-        } else if (!line.compare(0, 2, face_prefix)) {
-            std::vector<int> f;
-            std::vector<int> vt;
-            int itrash, idx, tex_idx;
-            iss >> trash;
-            while (iss >> idx >> trash >> tex_idx >> trash >> itrash) {
-                idx--; // in wavefront obj all indices start at 1, not zero
-                tex_idx--;
-                f.push_back(idx);
-                vt.push_back(tex_idx);
-            }
-            faces_.push_back(f);
-            verts_texture_idx_.push_back(vt);
-        } else if (!line.compare(0, 4, vert_texture_prefix)) {
-            iss >> trash;
-            iss >> trash;
-            glm::dvec3 vt;
-            for (int i = 0; i < 3; i++) iss >> vt[i];
-            verts_texture_.push_back(vt);
-        }
-        else if (!line.compare(0, 3, normal_prefix)) {
-            iss >> trash >> trash;
-            glm::dvec3 n;
-            for (int i = 0; i < 3; i++) iss >> n[i];
-            norms_.push_back(n);
-        }
-    }
-    std::cerr << "# v# " << verts_.size() << " #vt " << verts_texture_.size() << " vertex texture idx " << verts_texture_idx_.size() << " f# " << faces_.size() << " vn# " << norms_.size() << std::endl;
-
-    load_texture(filename, "_diffuse.tga", diffusemap);
-    diffusemap.flip_vertically();
-    load_texture(filename, "_nm.tga", normalmap);
-    normalmap.flip_vertically();
-    load_texture(filename, "_spec.tga", specularmap);
-    specularmap.flip_vertically();
-    load_texture(filename, "_glow.tga", glowmap);
-    glowmap.flip_vertically();
+// obj records, by the keyword starting their line
+enum ObjRecord { OBJ_OTHER, OBJ_VERT, OBJ_VERT_TEXTURE, OBJ_NORMAL, OBJ_FACE };
 
+// channels of an interleaved material texel: diffuse BGR, specular, octahedral normal, glow BGR, pad
+const int material_channels = 12;
+const int material_diffuse = 0;
+const int material_specular = 3;
+const int material_normal = 4;
+const int material_glow = 8;
+
+// asset pack: header, then each stream 16-byte aligned in the native layout of its type, textures as Texture::pack() writes them
+enum PackSection {
+    PACK_VERTS, PACK_NORMS, PACK_UVS, PACK_INDICES, PACK_TANGENTS,
+    PACK_MESHLETS, PACK_MESHLET_FACES, PACK_LODS, PACK_DIFFUSE, PACK_NORMALMAP, PACK_SPECULAR, PACK_GLOW, PACK_MATERIAL,
+    PACK_SECTIONS
+};
+struct PackHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t tangent_space;
+    uint32_t pad;
+    double bounds[6];
+    uint64_t offset[PACK_SECTIONS]; // textures start there, 0 when absent
+    uint64_t count[PACK_SECTIONS];  // elements of a stream
+};
+const uint32_t pack_version = 3;
+
+// obj files are parsed in chunks of at least this size
+const size_t min_obj_chunk_bytes = 1 << 20;
+
+// meshlet size limits
+const int max_meshlet_vertices = 64;
+const int max_meshlet_faces = 124;
+const double lod_normal_cos = 0.5; // vertices whose normals are further apart than 60 degrees aren't merged
+
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static ObjRecord obj_record(const char* p, const char* eol) {
+    size_t n = eol - p;
+    if (n >= 2 && p[0] == 'v' && is_space(p[1])) return OBJ_VERT;
+    if (n >= 3 && p[0] == 'v' && p[1] == 't' && is_space(p[2])) return OBJ_VERT_TEXTURE;
+    if (n >= 3 && p[0] == 'v' && p[1] == 'n' && is_space(p[2])) return OBJ_NORMAL;
+    if (n >= 2 && p[0] == 'f' && is_space(p[1])) return OBJ_FACE;
+    return OBJ_OTHER;
+}
+
+// std::from_chars neither skips spaces nor takes a leading '+'. returns p when there is no number
+template <typename T>
+static const char* parse_number(const char* p, const char* eol, T& value) {
+    const char* q = p;
+    while (q < eol && is_space(*q)) q++;
+    if (q < eol && *q == '+') q++;
+    std::from_chars_result r = std::from_chars(q, eol, value);
+    return r.ec == std::errc() ? r.ptr : p;
+}
+
+// up to 3 coordinates after the keyword, missing ones are 0
+static glm::dvec3 parse_vec3(const char* p, const char* eol) {
+    glm::dvec3 v(0.0);
+    while (p < eol && !is_space(*p)) p++;
+    for (int i = 0; i < 3; i++) p = parse_number(p, eol, v[i]);
+    return v;
+}
+
+// records of a stretch of whole lines of an obj file
+struct ObjChunk {
+    std::vector<glm::dvec3> verts;
+    std::vector<glm::dvec3> verts_texture;
+    std::vector<glm::dvec3> norms;
+    std::vector<glm::ivec3> corners;  // v, vt, vn indices of each triangle corner, -1 when absent
+    std::vector<size_t> relative[3];  // corners whose v, vt or vn index counts from the start of the chunk
+};
+
+// one face corner: v, v/vt, v//vn or v/vt/vn. indices become 0-based, negative ones count back from the records
+// read so far and are flagged in the relative bits, to be rebased once the earlier chunks are counted
+static const char* parse_corner(const char* p, const char* eol, const size_t counts[3], glm::ivec3& corner, int& relative) {
+    corner = glm::ivec3(-1);
+    relative = 0;
+    for (int k = 0; k < 3; k++) {
+        int idx;
+        const char* q = parse_number(p, eol, idx);
+        if (q == p) {
+            if (k == 0) return p; // no position, no corner
+        }
+        else if (idx < 0) {
+            corner[k] = (int)counts[k] + idx;
+            relative |= 1 << k;
+        }
+        else {
+            corner[k] = idx - 1; // in wavefront obj all indices start at 1, not zero
+        }
+        p = q;
+        if (k == 2 || p >= eol || *p != '/') break;
+        p++;
+    }
+    return p;
+}
+
+// a counting pass sizes the arrays, then each line is parsed in place. polygons are split into triangle fans.
+static void parse_obj_chunk(const char* begin, const char* end, ObjChunk& chunk) {
+    size_t counts[5] = { 0, 0, 0, 0, 0 };
+    for (const char* p = begin; p < end;) {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if (!eol) eol = end;
+        counts[obj_record(p, eol)]++;
+        p = eol + 1;
+    }
+    chunk.verts.reserve(counts[OBJ_VERT]);
+    chunk.verts_texture.reserve(counts[OBJ_VERT_TEXTURE]);
+    chunk.norms.reserve(counts[OBJ_NORMAL]);
+    chunk.corners.reserve(counts[OBJ_FACE] * 3);
+
+    std::vector<glm::ivec3> polygon;
+    std::vector<int> polygon_relative;
+    for (const char* p = begin; p < end;) {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if (!eol) eol = end;
+        switch (obj_record(p, eol)) {
+        case OBJ_VERT:
+            chunk.verts.push_back(parse_vec3(p, eol));
+            break;
+        case OBJ_VERT_TEXTURE:
+            chunk.verts_texture.push_back(parse_vec3(p, eol));
+            break;
+        case OBJ_NORMAL:
+            chunk.norms.push_back(parse_vec3(p, eol));
+            break;
+        case OBJ_FACE: {
+            size_t read[3] = { chunk.verts.size(), chunk.verts_texture.size(), chunk.norms.size() };
+            polygon.clear();
+            polygon_relative.clear();
+            glm::ivec3 corner;
+            int relative;
+            for (const char* q = p + 1, *next; (next = parse_corner(q, eol, read, corner, relative)) != q; q = next) {
+                polygon.push_back(corner);
+                polygon_relative.push_back(relative);
+            }
+            for (size_t i = 1; i + 1 < polygon.size(); i++) {
+                const size_t fan[3] = { 0, i, i + 1 };
+                for (size_t c : fan) {
+                    for (int k = 0; k < 3; k++) {
+                        if (polygon_relative[c] & (1 << k)) chunk.relative[k].push_back(chunk.corners.size());
+                    }
+                    chunk.corners.push_back(polygon[c]);
+                }
+            }
+            break;
+        }
+        default:
+            break;
+        }
+        p = eol + 1;
+    }
+}
+
+// large files are cut at line ends into chunks parsed in parallel. every record type only appends, so each chunk's
+// records land at the prefix sum of the earlier chunks' counts, which is also what its relative indices are rebased by.
+// the v/vt/vn triplets are then welded into one vertex per distinct triplet, see weld().
+void Model::parse_obj(const char* begin, const char* end) {
+    ThreadPool& pool = ThreadPool::instance();
+    size_t nchunks = std::clamp<size_t>((end - begin) / min_obj_chunk_bytes, 1, pool.size() * 4);
+    std::vector<const char*> cuts(nchunks + 1, end);
+    cuts[0] = begin;
+    for (size_t i = 1; i < nchunks; i++) {
+        const char* p = std::max(cuts[i - 1], begin + (end - begin) * i / nchunks);
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        cuts[i] = eol ? eol + 1 : end;
+    }
+    std::vector<ObjChunk> chunks(nchunks);
+    pool.parallel_for((int)nchunks, [&](int i) { parse_obj_chunk(cuts[i], cuts[i + 1], chunks[i]); });
+
+    std::vector<size_t> vert_offset(nchunks + 1, 0), vert_texture_offset(nchunks + 1, 0), norm_offset(nchunks + 1, 0), corner_offset(nchunks + 1, 0);
+    for (size_t i = 0; i < nchunks; i++) {
+        vert_offset[i + 1] = vert_offset[i] + chunks[i].verts.size();
+        vert_texture_offset[i + 1] = vert_texture_offset[i] + chunks[i].verts_texture.size();
+        norm_offset[i + 1] = norm_offset[i] + chunks[i].norms.size();
+        corner_offset[i + 1] = corner_offset[i] + chunks[i].corners.size();
+    }
+    std::vector<glm::dvec3> verts(vert_offset[nchunks]), verts_texture(vert_texture_offset[nchunks]), norms(norm_offset[nchunks]);
+    std::vector<glm::ivec3> corners(corner_offset[nchunks]);
+    pool.parallel_for((int)nchunks, [&](int i) {
+        ObjChunk& c = chunks[i];
+        std::copy(c.verts.begin(), c.verts.end(), verts.begin() + vert_offset[i]);
+        std::copy(c.verts_texture.begin(), c.verts_texture.end(), verts_texture.begin() + vert_texture_offset[i]);
+        std::copy(c.norms.begin(), c.norms.end(), norms.begin() + norm_offset[i]);
+        std::copy(c.corners.begin(), c.corners.end(), corners.begin() + corner_offset[i]);
+        const size_t base[3] = { vert_offset[i], vert_texture_offset[i], norm_offset[i] };
+        for (int k = 0; k < 3; k++) {
+            for (size_t r : c.relative[k]) corners[corner_offset[i] + r][k] += (int)base[k];
+        }
+    });
+    std::cerr << "# v# " << verts.size() << " #vt " << verts_texture.size() << " vn# " << norms.size() << " f# " << corners.size() / 3 << std::endl;
+    weld(verts, verts_texture, norms, corners);
+}
+
+struct TripletHash {
+    size_t operator()(const glm::ivec3& t) const {
+        return ((size_t)t.x * 73856093u) ^ ((size_t)t.y * 19349663u) ^ ((size_t)t.z * 83492791u);
+    }
+};
+
+// one vertex per distinct v/vt/vn triplet, so that a single index addresses every attribute as in a GPU vertex buffer.
+// triangles with a position out of range are dropped, out of range uvs read as 0 and missing normals are replaced
+// with the area weighted normals of the faces around the position.
+void Model::weld(const std::vector<glm::dvec3>& positions, const std::vector<glm::dvec3>& uvs, const std::vector<glm::dvec3>& normals, const std::vector<glm::ivec3>& corners) {
+    int npositions = (int)positions.size(), nuvs = (int)uvs.size(), nnormals = (int)normals.size();
+    bool complete = true;
+    for (const glm::ivec3& t : corners) complete = complete && t.z >= 0 && t.z < nnormals;
+    std::vector<glm::dvec3> face_normals(complete ? 0 : npositions, glm::dvec3(0.0));
+    for (size_t c = 0; c + 2 < corners.size() && !complete; c += 3) {
+        glm::ivec3 v(corners[c].x, corners[c + 1].x, corners[c + 2].x);
+        if (glm::any(glm::lessThan(v, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(v, glm::ivec3(npositions)))) continue;
+        glm::dvec3 n = glm::cross(positions[v.y] - positions[v.x], positions[v.z] - positions[v.x]);
+        for (int k = 0; k < 3; k++) face_normals[v[k]] += n;
+    }
+
+    std::unordered_map<glm::ivec3, uint32_t, TripletHash> welded;
+    welded.reserve(corners.size());
+    std::vector<glm::dvec3> verts, verts_texture, norms;
+    std::vector<uint32_t> indices;
+    indices.reserve(corners.size());
+    for (size_t c = 0; c + 2 < corners.size(); c += 3) {
+        bool valid = true;
+        for (int k = 0; k < 3; k++) valid = valid && corners[c + k].x >= 0 && corners[c + k].x < npositions;
+        if (!valid) continue;
+        for (int k = 0; k < 3; k++) {
+            glm::ivec3 t = corners[c + k];
+            if (t.y >= nuvs) t.y = -1;
+            if (t.z >= nnormals) t.z = -1;
+            auto it = welded.find(t);
+            if (it == welded.end()) {
+                it = welded.emplace(t, (uint32_t)verts.size()).first;
+                verts.push_back(positions[t.x]);
+                verts_texture.push_back(t.y >= 0 ? uvs[t.y] : glm::dvec3(0.0));
+                glm::dvec3 n = t.z >= 0 ? normals[t.z] : face_normals[t.x];
+                norms.push_back(glm::length(n) > 1e-12 ? n : glm::dvec3(0.0, 0.0, 1.0));
+            }
+            indices.push_back(it->second);
+        }
+    }
+    verts_.assign(std::move(verts));
+    verts_texture_.assign(std::move(verts_texture));
+    norms_.assign(std::move(norms));
+    indices_.assign(std::move(indices));
+}
+
+// name of a map next to the model file, empty when the file name has no extension to replace
+static std::string texture_path(const std::string& filename, const std::string& suffix) {
+    size_t dot = filename.find_last_of(".");
+    if (dot == std::string::npos) return std::string();
+    return filename.substr(0, dot) + suffix;
+}
+
+// with tangent_space the normal map is read from the _nm_tangent.tga texture, if there is one.
+// with sparse_textures the maps are virtual textures whose tiles are read on demand, see resolve_feedback().
+// maps come from the shared texture cache, starting at mip level texture_level
+// a filename ending in .pack is an asset pack written by write_pack(), the other arguments are then ignored.
+// with geometry_only nothing but the welded mesh is built, tangent_space then only tells whether a sub-model
+// built from this one computes tangents
+Model::Model(const char *filename, bool tangent_space, bool sparse_textures, int texture_level, bool geometry_only) : verts_(), indices_(), lod_(0), tangent_space_(false), ok_(true) {
+    std::string name(filename);
+    if (name.size() > 5 && !name.compare(name.size() - 5, 5, ".pack")) {
+        ok_ = read_pack(filename);
+        return;
+    }
+    // the maps load on the thread pool while the obj is parsed. the tangent-space normal map is only asked for
+    // when it exists, the object-space one being the fallback
+    std::string nm_tangent = texture_path(filename, "_nm_tangent.tga");
+    std::error_code ec;
+    bool try_tangent_space = tangent_space && !nm_tangent.empty() && std::filesystem::exists(nm_tangent, ec);
+    if (geometry_only) {
+        load_geometry(filename);
+        tangent_space_ = try_tangent_space;
+        return;
+    }
+    PendingTexture diffuse = load_texture_async(filename, "_diffuse.tga", sparse_textures, texture_level);
+    PendingTexture normal = load_texture_async(filename, try_tangent_space ? "_nm_tangent.tga" : "_nm.tga", sparse_textures, texture_level);
+    PendingTexture specular = load_texture_async(filename, "_spec.tga", sparse_textures, texture_level);
+    PendingTexture glow = load_texture_async(filename, "_glow.tga", sparse_textures, texture_level);
+
+    load_geometry(filename);
+    std::vector<Meshlet> meshlets;
+    std::vector<uint32_t> meshlet_faces;
+    build_meshlets(meshlets, meshlet_faces);
+    meshlets_.assign(std::move(meshlets));
+    meshlet_faces_.assign(std::move(meshlet_faces));
+    std::cerr << "# meshlets " << meshlets_.size() << std::endl;
+
+    diffusemap = diffuse.get();
+    normalmap = normal.get();
+    tangent_space_ = try_tangent_space && normalmap->levels() > 0;
+    if (try_tangent_space && !tangent_space_) normalmap = load_texture(filename, "_nm.tga", sparse_textures, texture_level);
+    if (tangent_space_) compute_tangents(); // only read through a tangent-space normal map
+    specularmap = specular.get();
+    glowmap = glow.get();
 }
 
+// the obj is parsed from a mapping rather than a heap copy of the file
+void Model::load_geometry(const char* filename) {
+    MappedFile file;
+    if (file.open(filename)) parse_obj((const char*)file.data(), (const char*)file.data() + file.size());
+    std::cerr << "# welded vertices " << verts_.size() << " triangles " << nfaces() << std::endl;
+    bounds_[0] = glm::dvec3(std::numeric_limits<double>::max());
+    bounds_[1] = glm::dvec3(-std::numeric_limits<double>::max());
+    for (size_t i = 0; i < verts_.size(); i++) {
+        bounds_[0] = glm::min(bounds_[0], verts_[i]);
+        bounds_[1] = glm::max(bounds_[1], verts_[i]);
+    }
+}
+
+// vertices are renumbered in the order the faces first use them. the interleaved materialmap isn't shared.
+// a tangent-space parent without tangents has them computed here over all of its faces around each vertex,
+// so that chunks of a geometry_only model come out as if the whole model had them
+Model::Model(Model& parent, const std::vector<int>& faces) : verts_(), indices_(), lod_(0), tangent_space_(parent.tangent_space_), ok_(true) {
+    std::unordered_map<uint32_t, uint32_t> remap;
+    std::vector<glm::dvec3> verts, norms, uvs;
+    std::vector<glm::dvec4> tangents;
+    std::vector<uint32_t> indices;
+    indices.reserve(faces.size() * 3);
+    for (int f : faces) {
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = parent.corners(f)[k];
+            auto it = remap.emplace(v, (uint32_t)verts.size());
+            if (it.second) {
+                verts.push_back(parent.verts_[v]);
+                norms.push_back(parent.norms_[v]);
+                uvs.push_back(parent.verts_texture_[v]);
+                if (parent.tangents_.size()) tangents.push_back(parent.tangents_[v]);
+            }
+            indices.push_back(it.first->second);
+        }
+    }
+    bounds_[0] = glm::dvec3(std::numeric_limits<double>::max());
+    bounds_[1] = glm::dvec3(-std::numeric_limits<double>::max());
+    for (const glm::dvec3& v : verts) {
+        bounds_[0] = glm::min(bounds_[0], v);
+        bounds_[1] = glm::max(bounds_[1], v);
+    }
+    verts_.assign(std::move(verts));
+    norms_.assign(std::move(norms));
+    verts_texture_.assign(std::move(uvs));
+    tangents_.assign(std::move(tangents));
+    indices_.assign(std::move(indices));
+    if (tangent_space_ && !parent.tangents_.size()) {
+        std::vector<glm::dvec3> tangent_sum(nverts(), glm::dvec3(0.0)), bitangent_sum(nverts(), glm::dvec3(0.0));
+        for (int f = 0; f < parent.nfaces(); f++) {
+            glm::uvec3 idx = parent.face(f);
+            glm::ivec3 local(-1);
+            for (int k = 0; k < 3; k++) {
+                auto it = remap.find(idx[k]);
+                if (it != remap.end()) local[k] = (int)it->second;
+            }
+            if (local != glm::ivec3(-1)) parent.face_tangent(idx, local, tangent_sum, bitangent_sum);
+        }
+        finish_tangents(tangent_sum, bitangent_sum);
+    }
+    std::vector<Meshlet> meshlets;
+    std::vector<uint32_t> meshlet_faces;
+    build_meshlets(meshlets, meshlet_faces);
+    meshlets_.assign(std::move(meshlets));
+    meshlet_faces_.assign(std::move(meshlet_faces));
+    diffusemap = parent.diffusemap;
+    normalmap = parent.normalmap;
+    specularmap = parent.specularmap;
+    glowmap = parent.glowmap;
+}
+
+// the streams and maps view the image, which the model keeps
+Model::Model(std::vector<unsigned char>&& pack) : verts_(), indices_(), lod_(0), tangent_space_(false), pack_image_(std::move(pack)), ok_(true) {
+    ok_ = view_pack(pack_image_.data(), pack_image_.size(), "image");
+}
+
+// the maps only held by the cache from now on may be evicted
 Model::~Model() {
+    diffusemap.reset();
+    normalmap.reset();
+    specularmap.reset();
+    glowmap.reset();
+    TextureCache::instance().trim();
+}
+
+bool Model::ok() {
+    return ok_;
 }
 
 int Model::nverts() {
@@ -73,24 +408,44 @@ int Model::nverts() {
 }
 
 int Model::nfaces() {
-    return (int)faces_.size();
+    return lods_.size() ? lods_[lod_].face_count : (int)indices_.size() / 3;
 }
 
 int Model::nvertTex() {
     return (int)verts_texture_.size();
 }
 
+int Model::nmeshlets() {
+    return lods_.size() ? lods_[lod_].meshlet_count : (int)meshlets_.size();
+}
+
+const Meshlet& Model::meshlet(int i) {
+    return meshlets_[(lods_.size() ? lods_[lod_].meshlet_offset : 0) + i];
+}
+
+// faces of meshlet m are meshlet_face(m.face_offset) .. meshlet_face(m.face_offset + m.face_count - 1)
+int Model::meshlet_face(int i) {
+    return meshlet_faces_[i];
+}
+
+// vertices of a face of the current lod
+const uint32_t* Model::corners(int iface) {
+    return indices_.data() + ((lods_.size() ? lods_[lod_].face_offset : 0) + iface) * 3;
+}
+
 // list of index to vertices making up this face idx
-std::vector<int> Model::face(int idx) {
-    return faces_[idx];
+glm::uvec3 Model::face(int idx) {
+    const uint32_t* f = corners(idx);
+    return glm::uvec3(f[0], f[1], f[2]);
 }
 
-std::vector<int> Model::vert_texture_idx(int idx) {
-    return verts_texture_idx_[idx];
+// vertices are unified, the uv of a corner has the index of its position
+glm::uvec3 Model::vert_texture_idx(int idx) {
+    return face(idx);
 }
 
 glm::dvec3 Model::normal(int iface) {
-    std::vector<int> face = this->face(iface);
+    glm::uvec3 face = this->face(iface);
     glm::dvec3 world_coords[3];
     for (int j = 0; j < 3; j++) {
         world_coords[j] = this->vert(face[j]);
@@ -99,10 +454,28 @@ glm::dvec3 Model::normal(int iface) {
 }
 
 glm::dvec3 Model::normal(int iface, int nthvert) {
-    int idx = faces_[iface][nthvert];
+    int idx = corners(iface)[nthvert];
     return glm::normalize(norms_[idx]);
 }
 
+// models without a tangent-space normal map have no tangents, +x is returned then
+glm::dvec4 Model::tangent(int iface, int nthvert) {
+    if (!tangents_.size()) return glm::dvec4(1.0, 0.0, 0.0, 1.0);
+    return tangents_[corners(iface)[nthvert]];
+}
+
+bool Model::tangent_space() {
+    return tangent_space_;
+}
+
+glm::dvec3 Model::bounds_min() {
+    return bounds_[0];
+}
+
+glm::dvec3 Model::bounds_max() {
+    return bounds_[1];
+}
+
 glm::dvec3 Model::vert(int i) {
     return verts_[i];
 }
@@ -111,10 +484,644 @@ glm::dvec3 Model::vert_texture(int i) {
     return verts_texture_[i];
 }
 
-void Model::load_texture(std::string filename, const std::string suffix, TGAImage& img) {
-    size_t dot = filename.find_last_of(".");
-    if (dot == std::string::npos) return;
-    std::string texfile = filename.substr(0, dot) + suffix;
-    std::cerr << "texture file " << texfile << " loading " << (img.read_tga_file(texfile.c_str()) ? "ok" : "failed") << std::endl;
+std::shared_ptr<Texture> Model::load_texture(std::string filename, const std::string suffix, bool sparse, int level) {
+    std::string path = texture_path(filename, suffix);
+    if (path.empty()) return std::make_shared<Texture>();
+    return TextureCache::instance().get(path, level, sparse);
+}
+
+PendingTexture Model::load_texture_async(std::string filename, const std::string suffix, bool sparse, int level) {
+    std::string path = texture_path(filename, suffix);
+    if (!path.empty()) return TextureCache::instance().get_async(path, level, sparse);
+    std::promise<std::shared_ptr<Texture>> none;
+    none.set_value(std::make_shared<Texture>());
+    return none.get_future().share();
+}
+
+// reads the tiles the sparse maps missed since the last call, returns how many were loaded
+int Model::resolve_feedback() {
+    Texture* maps[4] = { diffusemap.get(), normalmap.get(), specularmap.get(), glowmap.get() };
+    int loaded = 0;
+    for (Texture* map : maps) loaded += map->resolve_feedback();
+    return loaded;
+}
+
+// greedy clustering: each meshlet grows from the first unassigned face through faces sharing its vertices
+// until it runs out of vertex or face slots, then gets a bounding sphere and a normal cone
+void Model::build_meshlets(std::vector<Meshlet>& meshlets, std::vector<uint32_t>& meshlet_faces) {
+    int nf = nfaces();
+    auto corners = [this](int f) { const uint32_t* c = this->corners(f); return std::array<uint32_t, 3>{ c[0], c[1], c[2] }; };
+    int first = (int)meshlets.size();
+    // faces are adjacent through shared positions, vertices split at uv or normal seams don't break the growth
+    std::vector<int> order(nverts()), point(nverts());
+    std::iota(order.begin(), order.end(), 0);
+    auto position_less = [this](int a, int b) {
+        return std::lexicographical_compare(&verts_[a].x, &verts_[a].x + 3, &verts_[b].x, &verts_[b].x + 3);
+    };
+    std::sort(order.begin(), order.end(), position_less);
+    int npoints = 0;
+    for (int i = 0; i < nverts(); i++) {
+        if (i > 0 && verts_[order[i]] != verts_[order[i - 1]]) npoints++;
+        point[order[i]] = npoints;
+    }
+    npoints += nverts() > 0;
+    std::vector<int> point_faces_start(npoints + 1, 0);
+    for (int f = 0; f < nf; f++) {
+        for (int v : corners(f)) point_faces_start[point[v] + 1]++;
+    }
+    for (int p = 0; p < npoints; p++) point_faces_start[p + 1] += point_faces_start[p];
+    std::vector<int> point_faces(point_faces_start[npoints]);
+    std::vector<int> fill(point_faces_start.begin(), point_faces_start.end() - 1);
+    for (int f = 0; f < nf; f++) {
+        for (int v : corners(f)) point_faces[fill[point[v]]++] = f;
+    }
+
+    std::vector<bool> assigned(nf, false);
+    std::vector<int> vert_owner(nverts(), -1); // last meshlet that referenced the vertex
+    std::vector<int> queue;
+    int seed = 0;
+    while (true) {
+        while (seed < nf && assigned[seed]) seed++;
+        if (seed == nf) break;
+
+        int id = (int)meshlets.size() - first;
+        Meshlet m;
+        m.face_offset = (int)meshlet_faces.size();
+        m.face_count = 0;
+        int vert_count = 0;
+        queue.assign(1, seed);
+        for (size_t q = 0; q < queue.size() && m.face_count < max_meshlet_faces; q++) {
+            int f = queue[q];
+            if (assigned[f]) continue;
+            int new_verts = 0;
+            for (int v : corners(f)) new_verts += (vert_owner[v] != id);
+            if (vert_count + new_verts > max_meshlet_vertices) continue;
+
+            assigned[f] = true;
+            meshlet_faces.push_back(f);
+            m.face_count++;
+            for (int v : corners(f)) {
+                if (vert_owner[v] == id) continue;
+                vert_owner[v] = id;
+                vert_count++;
+                for (int k = point_faces_start[point[v]]; k < point_faces_start[point[v] + 1]; k++) {
+                    if (!assigned[point_faces[k]]) queue.push_back(point_faces[k]);
+                }
+            }
+        }
+
+        // bounding sphere around the center of the bbox
+        glm::dvec3 lo(std::numeric_limits<double>::max()), hi(-std::numeric_limits<double>::max());
+        for (int i = m.face_offset; i < m.face_offset + m.face_count; i++) {
+            for (int v : corners(meshlet_faces[i])) {
+                lo = glm::min(lo, verts_[v]);
+                hi = glm::max(hi, verts_[v]);
+            }
+        }
+        glm::dvec3 center = (lo + hi) * 0.5;
+        double radius = 0.0;
+        for (int i = m.face_offset; i < m.face_offset + m.face_count; i++) {
+            for (int v : corners(meshlet_faces[i])) radius = std::max(radius, glm::length(verts_[v] - center));
+        }
+        m.sphere = glm::dvec4(center, radius);
+
+        // normal cone around the average face normal, degenerate faces don't constrain it
+        glm::dvec3 axis(0.0);
+        for (int i = m.face_offset; i < m.face_offset + m.face_count; i++) {
+            glm::dvec3 n = normal(meshlet_faces[i]);
+            if (n == n) axis += n;
+        }
+        m.cone = glm::dvec4(0.0, 0.0, 0.0, 2.0);
+        if (glm::length(axis) > 1e-9) {
+            axis = glm::normalize(axis);
+            double mindp = 1.0;
+            for (int i = m.face_offset; i < m.face_offset + m.face_count; i++) {
+                glm::dvec3 n = normal(meshlet_faces[i]);
+                if (n == n) mindp = std::min(mindp, glm::dot(axis, n));
+            }
+            if (mindp > 0.0) m.cone = glm::dvec4(axis, std::sqrt(1.0 - mindp * mindp));
+        }
+        meshlets.push_back(m);
+    }
+}
+
+// normal map texels are either octahedral unit vectors or RGB bytes holding xyz
+static glm::dvec3 texel_normal(Texture& map, const double* texel) {
+    int k = map.get_octahedral();
+    if (k >= 0) return glm::dvec3(texel[k], texel[k + 1], texel[k + 2]);
+    glm::dvec3 n;
+    for (int i = 0; i < 3; i++) n[2 - i] = texel[i] / 255.0 * 2.0 - 1.0;
+    return n;
+}
+
+// unit normal of an RGB normal map texel, +z when it has no length
+static void encode_rgb_normal(const unsigned char* bgr, unsigned char* dst) {
+    glm::dvec3 n;
+    for (int i = 0; i < 3; i++) n[2 - i] = bgr[i] / 255.0 * 2.0 - 1.0;
+    encode_octahedral(glm::length(n) > 1e-12 ? glm::normalize(n) : glm::dvec3(0.0, 0.0, 1.0), dst);
+}
+
+// packs the four material maps into one texture whose texels hold every channel the shader reads, so that
+// sampling them costs a single fetch. normals are stored octahedral. maps are resampled to the largest one,
+// missing maps read as black. maps of that size are copied from their rows, the others fetched texel by texel.
+// the model lets go of the separate maps afterwards.
+void Model::interleave_materials() {
+    std::shared_ptr<Texture>* maps[4] = { &diffusemap, &specularmap, &normalmap, &glowmap };
+    const int offsets[4] = { material_diffuse, material_specular, material_normal, material_glow };
+    const int channels[4] = { 3, 1, 3, 3 };
+    int width = 0, height = 0;
+    for (std::shared_ptr<Texture>* map : maps) {
+        if ((*map)->sparse()) return;
+        width = std::max(width, (*map)->get_width());
+        height = std::max(height, (*map)->get_height());
+    }
+    if (!width || !height) return;
+
+    std::vector<unsigned char> texels(width * height * material_channels, 0);
+    std::vector<unsigned char> rows;
+    for (int m = 0; m < 4; m++) {
+        Texture& map = **maps[m];
+        bool normals = (maps[m] == &normalmap);
+        int bytespp = map.get_bytespp();
+        bool copy = map.levels() && map.get_width() == width && map.get_height() == height && (!normals || bytespp >= 3);
+        if (copy) {
+            rows.resize((size_t)width * height * bytespp);
+            copy = map.read_rows(0, rows.data());
+        }
+        if (copy) {
+            int octahedral = map.get_octahedral();
+            int n = std::min(channels[m], bytespp);
+            for (size_t i = 0; i < (size_t)width * height; i++) {
+                unsigned char* dst = &texels[i * material_channels + offsets[m]];
+                const unsigned char* src = &rows[i * bytespp];
+                if (!normals) memcpy(dst, src, n);
+                else if (octahedral >= 0) memcpy(dst, src + octahedral, 4);
+                else encode_rgb_normal(src, dst);
+            }
+            *maps[m] = std::make_shared<Texture>();
+            continue;
+        }
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                unsigned char* dst = &texels[(x + y * width) * material_channels + offsets[m]];
+                double src[max_texel_channels];
+                if (!map.levels() || !map.fetch(0, x * map.get_width() / width, y * map.get_height() / height, src)) {
+                    if (normals) encode_octahedral(glm::dvec3(0.0, 0.0, 1.0), dst);
+                    continue;
+                }
+                if (normals) {
+                    glm::dvec3 n = texel_normal(map, src);
+                    encode_octahedral(glm::length(n) > 1e-12 ? glm::normalize(n) : glm::dvec3(0.0, 0.0, 1.0), dst);
+                    continue;
+                }
+                for (int c = 0; c < std::min(channels[m], map.get_bytespp()); c++) dst[c] = (unsigned char)std::lround(src[c]);
+            }
+        }
+        *maps[m] = std::make_shared<Texture>();
+    }
+    materialmap.build(texels.data(), width, height, material_channels, Texture::TILED, material_normal);
 }
 
+// decodes the normal map once into octahedral unit vectors, so that sampling returns them without any per-pixel decode.
+// the encoded map is cached on its own, models sharing the source map still read it as it is
+void Model::encode_normals() {
+    normalmap = TextureCache::instance().get_variant(normalmap, "octahedral", [](const std::shared_ptr<Texture>& source) -> std::shared_ptr<Texture> {
+        Texture& map = *source;
+        if (!map.levels() || map.get_octahedral() >= 0 || map.sparse() || map.get_bytespp() < 3) return nullptr;
+        int width = map.get_width(), height = map.get_height(), bytespp = map.get_bytespp();
+        std::vector<unsigned char> rows((size_t)width * height * bytespp);
+        std::vector<unsigned char> texels((size_t)width * height * 4);
+        if (map.read_rows(0, rows.data())) {
+            for (size_t i = 0; i < (size_t)width * height; i++) encode_rgb_normal(&rows[i * bytespp], &texels[i * 4]);
+        }
+        else {
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    double src[max_texel_channels];
+                    map.fetch(0, x, y, src);
+                    glm::dvec3 n = texel_normal(map, src);
+                    encode_octahedral(glm::length(n) > 1e-12 ? glm::normalize(n) : glm::dvec3(0.0, 0.0, 1.0), &texels[(x + y * width) * 4]);
+                }
+            }
+        }
+        std::shared_ptr<Texture> encoded = std::make_shared<Texture>();
+        encoded->build(texels.data(), width, height, 4, map.get_layout(), 0);
+        return encoded;
+    });
+}
+
+// block compressed copy of a map, cached on its own so that models sharing the map still read it uncompressed
+static std::shared_ptr<Texture> compressed(const std::shared_ptr<Texture>& map, Texture::Format format) {
+    static const char* names[] = { "raw", "bc1", "bc4", "bc5" };
+    return TextureCache::instance().get_variant(map, names[format], [format](const std::shared_ptr<Texture>& source) {
+        std::shared_ptr<Texture> copy = std::make_shared<Texture>(*source);
+        return copy->compress(format) ? copy : nullptr;
+    });
+}
+
+// block compresses the material maps: BC1 for the color and object-space normal maps, BC5 for tangent-space
+// normal maps and BC4 for the specular map
+void Model::compress_textures() {
+    size_t before = diffusemap->size() + normalmap->size() + specularmap->size() + glowmap->size();
+    diffusemap = compressed(diffusemap, Texture::BC1);
+    normalmap = compressed(normalmap, tangent_space_ ? Texture::BC5 : Texture::BC1);
+    specularmap = compressed(specularmap, Texture::BC4);
+    glowmap = compressed(glowmap, Texture::BC1);
+    size_t after = diffusemap->size() + normalmap->size() + specularmap->size() + glowmap->size();
+    std::cerr << "# textures compressed " << before / 1024 << "KB -> " << after / 1024 << "KB" << std::endl;
+}
+
+static TGAColor texel_color(const double* texel, int n) {
+    TGAColor color;
+    color.bytespp = n;
+    for (int c = 0; c < n; c++) color[c] = (unsigned char)(texel[c] + 0.5);
+    return color;
+}
+
+// material maps at uv: one fetch from the interleaved store when there is one, else one fetch per map
+Material Model::material(const Sampler& sampler, glm::dvec2 uv, glm::dmat2 duv) {
+    Material mat;
+    if (materialmap.levels()) {
+        double texel[max_texel_channels];
+        sampler.sample(materialmap, uv, Sampler::lod(materialmap, duv), texel);
+        mat.diffuse = texel_color(texel + material_diffuse, 3);
+        mat.specular = texel_color(texel + material_specular, 1);
+        mat.normal = texel_normal(materialmap, texel);
+        mat.glow = texel_color(texel + material_glow, 3);
+        return mat;
+    }
+    mat.diffuse = sampler.sample(*diffusemap, uv, Sampler::lod(*diffusemap, duv));
+    mat.specular = sampler.sample(*specularmap, uv, Sampler::lod(*specularmap, duv));
+    double texel[max_texel_channels];
+    sampler.sample(*normalmap, uv, Sampler::lod(*normalmap, duv), texel);
+    mat.normal = texel_normal(*normalmap, texel);
+    mat.glow = sampler.sample(*glowmap, uv, Sampler::lod(*glowmap, duv));
+    return mat;
+}
+
+// summed squared distance of p to the planes accumulated in q
+static double quadric_error(const glm::dmat4& q, glm::dvec3 p) {
+    glm::dvec4 h(p, 1.0);
+    return std::max(glm::dot(h, q * h), 0.0);
+}
+
+// quadric error metric simplification by half-edge collapses: a vertex is merged into a neighbour it shares an edge
+// with, so that every lod indexes the same vertex buffer. collapses are taken cheapest first, a batch at a time, and
+// each one leaves its ring alone for the rest of the batch. vertices on borders and on uv or normal seams, where the
+// vertex buffer splits a position, never move. collapses flipping a face or merging vertices with normals far apart
+// are refused. each lod has about half the faces of the previous one, the chain stops at min_faces
+int Model::build_lods(int min_faces) {
+    set_lod(0);
+    int nv = nverts();
+    std::vector<uint32_t> current(corners(0), corners(0) + nfaces() * 3);
+    std::vector<uint32_t> indices(current);
+    std::vector<Lod> lods(1, Lod{ 0, nfaces(), 0, 0, 0.0 });
+
+    std::vector<bool> locked(nv, false);
+    std::vector<int> order(nv);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [this](int a, int b) {
+        return std::lexicographical_compare(&verts_[a].x, &verts_[a].x + 3, &verts_[b].x, &verts_[b].x + 3);
+    });
+    for (int i = 1; i < nv; i++) {
+        if (verts_[order[i]] == verts_[order[i - 1]]) locked[order[i]] = locked[order[i - 1]] = true;
+    }
+    std::unordered_map<uint64_t, int> edges;
+    for (size_t c = 0; c < current.size(); c++) {
+        uint32_t a = current[c], b = current[c - c % 3 + (c + 1) % 3];
+        edges[(uint64_t)std::min(a, b) << 32 | std::max(a, b)]++;
+    }
+    for (const auto& e : edges) {
+        if (e.second == 1) locked[e.first >> 32] = locked[e.first & 0xffffffff] = true;
+    }
+
+    // planes weighted by face area, the weights summed apart to turn errors into mean squared distances
+    std::vector<glm::dmat4> quadrics(nv, glm::dmat4(0.0));
+    std::vector<double> weights(nv, 0.0);
+    for (size_t f = 0; f < current.size() / 3; f++) {
+        glm::dvec3 p0 = verts_[current[f * 3]];
+        glm::dvec3 n = glm::cross(verts_[current[f * 3 + 1]] - p0, verts_[current[f * 3 + 2]] - p0);
+        double area = glm::length(n) * 0.5;
+        if (area < 1e-12) continue;
+        n = glm::normalize(n);
+        glm::dvec4 plane(n, -glm::dot(n, p0));
+        glm::dmat4 q = glm::outerProduct(plane, plane) * area;
+        for (int k = 0; k < 3; k++) {
+            quadrics[current[f * 3 + k]] += q;
+            weights[current[f * 3 + k]] += area;
+        }
+    }
+
+    double error = 0.0; // largest mean squared distance of a collapse so far
+    std::vector<std::pair<double, uint64_t>> candidates;
+    std::vector<int> vert_faces_start(nv + 1), vert_faces;
+    std::vector<bool> touched(nv);
+    std::vector<uint32_t> remap(nv);
+    std::iota(remap.begin(), remap.end(), 0);
+    bool stuck = false;
+    while (!stuck && (int)current.size() / 6 >= min_faces) {
+        int target = (int)current.size() / 6;
+        while ((int)current.size() / 3 > target) {
+            int nf = (int)current.size() / 3;
+            std::fill(vert_faces_start.begin(), vert_faces_start.end(), 0);
+            for (uint32_t v : current) vert_faces_start[v + 1]++;
+            for (int v = 0; v < nv; v++) vert_faces_start[v + 1] += vert_faces_start[v];
+            vert_faces.resize(current.size());
+            std::vector<int> fill(vert_faces_start.begin(), vert_faces_start.end() - 1);
+            for (size_t c = 0; c < current.size(); c++) vert_faces[fill[current[c]]++] = (int)(c / 3);
+
+            candidates.clear();
+            for (size_t c = 0; c < current.size(); c++) {
+                uint32_t a = current[c], b = current[c - c % 3 + (c + 1) % 3];
+                if (!locked[a]) candidates.push_back({ quadric_error(quadrics[a] + quadrics[b], verts_[b]), (uint64_t)a << 32 | b });
+                if (!locked[b]) candidates.push_back({ quadric_error(quadrics[a] + quadrics[b], verts_[a]), (uint64_t)b << 32 | a });
+            }
+            std::sort(candidates.begin(), candidates.end());
+
+            std::fill(touched.begin(), touched.end(), false);
+            int collapses = 0, needed = (nf - target + 1) / 2;
+            for (const auto& c : candidates) {
+                if (collapses >= needed) break;
+                uint32_t u = (uint32_t)(c.second >> 32), v = (uint32_t)c.second;
+                if (touched[u] || touched[v]) continue;
+                if (glm::dot(glm::normalize(norms_[u]), glm::normalize(norms_[v])) < lod_normal_cos) continue;
+                bool valid = true;
+                for (int k = vert_faces_start[u]; valid && k < vert_faces_start[u + 1]; k++) {
+                    const uint32_t* t = &current[vert_faces[k] * 3];
+                    if (t[0] == v || t[1] == v || t[2] == v) continue;
+                    glm::dvec3 p[3], q[3];
+                    for (int j = 0; j < 3; j++) {
+                        p[j] = verts_[t[j]];
+                        q[j] = t[j] == u ? verts_[v] : p[j];
+                    }
+                    glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]), after = glm::cross(q[1] - q[0], q[2] - q[0]);
+                    valid = glm::length(after) > 1e-12 && glm::dot(before, after) > 0.0;
+                }
+                if (!valid) continue;
+                remap[u] = v;
+                error = std::max(error, c.first / std::max(weights[u] + weights[v], 1e-12));
+                quadrics[v] += quadrics[u];
+                weights[v] += weights[u];
+                for (int k = vert_faces_start[u]; k < vert_faces_start[u + 1]; k++) {
+                    for (int j = 0; j < 3; j++) touched[current[vert_faces[k] * 3 + j]] = true;
+                }
+                collapses++;
+            }
+            if (!collapses) {
+                stuck = true;
+                break;
+            }
+            size_t kept = 0;
+            for (size_t f = 0; f < current.size(); f += 3) {
+                uint32_t a = remap[current[f]], b = remap[current[f + 1]], c = remap[current[f + 2]];
+                if (a == b || b == c || a == c) continue;
+                current[kept++] = a;
+                current[kept++] = b;
+                current[kept++] = c;
+            }
+            current.resize(kept);
+            std::iota(remap.begin(), remap.end(), 0);
+        }
+        if ((int)current.size() / 3 >= lods.back().face_count) break;
+        lods.push_back(Lod{ (int)indices.size() / 3, (int)current.size() / 3, 0, 0, std::sqrt(error) });
+        indices.insert(indices.end(), current.begin(), current.end());
+    }
+
+    indices_.assign(std::move(indices));
+    lods_.assign(std::vector<Lod>(lods));
+    std::vector<Meshlet> meshlets;
+    std::vector<uint32_t> meshlet_faces;
+    for (size_t l = 0; l < lods.size(); l++) {
+        lod_ = (int)l;
+        lods[l].meshlet_offset = (int)meshlets.size();
+        build_meshlets(meshlets, meshlet_faces);
+        lods[l].meshlet_count = (int)meshlets.size() - lods[l].meshlet_offset;
+    }
+    lod_ = 0;
+    lods_.assign(std::move(lods));
+    meshlets_.assign(std::move(meshlets));
+    meshlet_faces_.assign(std::move(meshlet_faces));
+    std::cerr << "# lods";
+    for (size_t l = 0; l < lods_.size(); l++) std::cerr << " " << lods_[l].face_count;
+    std::cerr << std::endl;
+    return nlods();
+}
+
+int Model::nlods() {
+    return lods_.size() ? (int)lods_.size() : 1;
+}
+
+double Model::lod_error(int lod) {
+    return lods_.size() ? lods_[lod].error : 0.0;
+}
+
+// clamped to the lods there are
+void Model::set_lod(int lod) {
+    lod_ = std::max(0, std::min(lod, nlods() - 1));
+}
+
+// per-vertex tangent frames in the spirit of MikkTSpace: face tangents are accumulated at each corner weighted by
+// the corner angle, then made orthogonal to the vertex normal. welded vertices already split at uv seams.
+// here face idx adds to the sums of its corners, corner k going to sums[local[k]], or nowhere when local[k] is negative
+void Model::face_tangent(glm::uvec3 idx, glm::ivec3 local, std::vector<glm::dvec3>& tangent_sum, std::vector<glm::dvec3>& bitangent_sum) {
+    glm::dvec3 p[3], uv[3];
+    for (int k = 0; k < 3; k++) {
+        p[k] = verts_[idx[k]];
+        uv[k] = verts_texture_[idx[k]];
+    }
+    glm::dvec3 e1 = p[1] - p[0], e2 = p[2] - p[0];
+    glm::dvec2 d1 = glm::dvec2(uv[1] - uv[0]), d2 = glm::dvec2(uv[2] - uv[0]);
+    double det = d1.x * d2.y - d2.x * d1.y;
+    if (std::abs(det) < 1e-12) return;
+    glm::dvec3 t = (e1 * d2.y - e2 * d1.y) / det;
+    glm::dvec3 b = (e2 * d1.x - e1 * d2.x) / det;
+    if (glm::length(t) < 1e-12 || glm::length(b) < 1e-12) return;
+    t = glm::normalize(t);
+    b = glm::normalize(b);
+    for (int k = 0; k < 3; k++) {
+        if (local[k] < 0) continue;
+        glm::dvec3 a = p[(k + 1) % 3] - p[k], c = p[(k + 2) % 3] - p[k];
+        if (glm::length(a) < 1e-12 || glm::length(c) < 1e-12) continue;
+        double angle = std::acos(std::clamp(glm::dot(glm::normalize(a), glm::normalize(c)), -1.0, 1.0));
+        tangent_sum[local[k]] += t * angle;
+        bitangent_sum[local[k]] += b * angle;
+    }
+}
+
+// per vertex sums orthogonalized against the normal, with the bitangent kept as a sign
+void Model::finish_tangents(const std::vector<glm::dvec3>& tangent_sum, const std::vector<glm::dvec3>& bitangent_sum) {
+    std::vector<glm::dvec4> tangents(nverts());
+    for (int i = 0; i < nverts(); i++) {
+        glm::dvec3 n = glm::normalize(norms_[i]);
+        glm::dvec3 t = tangent_sum[i] - n * glm::dot(n, tangent_sum[i]);
+        if (glm::length(t) < 1e-12) {
+            // no usable uv gradient: any direction orthogonal to the normal
+            t = glm::cross(n, std::abs(n.x) < 0.9 ? glm::dvec3(1.0, 0.0, 0.0) : glm::dvec3(0.0, 1.0, 0.0));
+        }
+        t = glm::normalize(t);
+        double sign = glm::dot(glm::cross(n, t), bitangent_sum[i]) < 0.0 ? -1.0 : 1.0;
+        tangents[i] = glm::dvec4(t, sign);
+    }
+    tangents_.assign(std::move(tangents));
+}
+
+void Model::compute_tangents() {
+    std::vector<glm::dvec3> tangent_sum(nverts(), glm::dvec3(0.0)), bitangent_sum(nverts(), glm::dvec3(0.0));
+    for (int f = 0; f < nfaces(); f++) {
+        glm::uvec3 idx = face(f);
+        face_tangent(idx, glm::ivec3(idx), tangent_sum, bitangent_sum);
+    }
+    finish_tangents(tangent_sum, bitangent_sum);
+}
+
+template <typename T>
+static void pack_stream(std::vector<unsigned char>& file, PackHeader& header, PackSection section, const Stream<T>& stream) {
+    pack_align(file);
+    header.offset[section] = file.size();
+    header.count[section] = stream.size();
+    const unsigned char* data = (const unsigned char*)stream.data();
+    file.insert(file.end(), data, data + stream.size() * sizeof(T));
+}
+
+// the file image is assembled in memory. sparse maps can't be packed and are left out
+void Model::pack(std::vector<unsigned char>& file, bool textures) {
+    file.assign(sizeof(PackHeader), 0);
+    PackHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "MPAK", 4);
+    header.version = pack_version;
+    header.tangent_space = tangent_space_;
+    for (int i = 0; i < 3; i++) {
+        header.bounds[i] = bounds_[0][i];
+        header.bounds[3 + i] = bounds_[1][i];
+    }
+    pack_stream(file, header, PACK_VERTS, verts_);
+    pack_stream(file, header, PACK_NORMS, norms_);
+    pack_stream(file, header, PACK_UVS, verts_texture_);
+    pack_stream(file, header, PACK_INDICES, indices_);
+    pack_stream(file, header, PACK_TANGENTS, tangents_);
+    pack_stream(file, header, PACK_MESHLETS, meshlets_);
+    pack_stream(file, header, PACK_MESHLET_FACES, meshlet_faces_);
+    pack_stream(file, header, PACK_LODS, lods_);
+    Texture* maps[5] = { diffusemap.get(), normalmap.get(), specularmap.get(), glowmap.get(), &materialmap };
+    for (int i = 0; textures && i < 5; i++) {
+        if (maps[i] && maps[i]->sparse()) std::cerr << "sparse texture left out of the asset pack" << std::endl;
+        header.offset[PACK_DIFFUSE + i] = maps[i] ? maps[i]->pack(file) : 0;
+    }
+    memcpy(file.data(), &header, sizeof(header));
+}
+
+// written at once
+bool Model::write_pack(const char* filename) {
+    std::vector<unsigned char> file;
+    pack(file);
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    out.write((const char*)file.data(), file.size());
+    if (!out.good()) {
+        std::cerr << "can't dump the asset pack\n";
+        return false;
+    }
+    std::cerr << "# asset pack " << filename << " " << file.size() / 1024 << "KB" << std::endl;
+    return true;
+}
+
+template <typename T>
+static bool view_stream(const unsigned char* data, size_t size, const PackHeader& header, PackSection section, Stream<T>& stream) {
+    uint64_t offset = header.offset[section], count = header.count[section];
+    if (offset % alignof(T) || offset > size || count > (size - offset) / sizeof(T)) return false;
+    stream.view((const T*)(data + header.offset[section]), header.count[section]);
+    return true;
+}
+
+// everything is viewed in the mapping: nothing is parsed, decoded or copied
+bool Model::read_pack(const char* filename) {
+    pack_ = std::make_shared<MappedFile>();
+    if (!pack_->open(filename)) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    if (!view_pack(pack_->data(), pack_->size(), filename)) return false;
+    std::cerr << "# asset pack " << filename << " v# " << verts_.size() << " f# " << nfaces() << " meshlets " << meshlets_.size() << " lods " << nlods() << std::endl;
+    return true;
+}
+
+// leaves the model empty, with nothing viewing the pack anymore
+void Model::drop_pack() {
+    verts_.view(nullptr, 0);
+    norms_.view(nullptr, 0);
+    verts_texture_.view(nullptr, 0);
+    indices_.view(nullptr, 0);
+    tangents_.view(nullptr, 0);
+    meshlets_.view(nullptr, 0);
+    meshlet_faces_.view(nullptr, 0);
+    lods_.view(nullptr, 0);
+    std::shared_ptr<Texture>* maps[4] = { &diffusemap, &normalmap, &specularmap, &glowmap };
+    for (std::shared_ptr<Texture>* map : maps) *map = std::make_shared<Texture>();
+    materialmap = Texture();
+    tangent_space_ = false;
+}
+
+// the memory has to live as long as the model. a bad pack leaves the model empty
+bool Model::view_pack(const unsigned char* data, size_t size, const char* name) {
+    std::shared_ptr<Texture>* maps[4] = { &diffusemap, &normalmap, &specularmap, &glowmap };
+    PackHeader header;
+    if (size < sizeof(header)) {
+        std::cerr << "bad asset pack " << name << "\n";
+        drop_pack();
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, "MPAK", 4) || header.version != pack_version) {
+        std::cerr << "bad asset pack " << name << "\n";
+        drop_pack();
+        return false;
+    }
+    bool ok = view_stream(data, size, header, PACK_VERTS, verts_) && view_stream(data, size, header, PACK_NORMS, norms_) &&
+        view_stream(data, size, header, PACK_UVS, verts_texture_) && view_stream(data, size, header, PACK_INDICES, indices_) &&
+        view_stream(data, size, header, PACK_TANGENTS, tangents_) && view_stream(data, size, header, PACK_MESHLETS, meshlets_) &&
+        view_stream(data, size, header, PACK_MESHLET_FACES, meshlet_faces_) && view_stream(data, size, header, PACK_LODS, lods_);
+    tangent_space_ = header.tangent_space;
+    for (int i = 0; ok && i < 4; i++) {
+        if (header.offset[PACK_DIFFUSE + i]) ok = (*maps[i])->unpack(data, size, header.offset[PACK_DIFFUSE + i]);
+    }
+    if (ok && header.offset[PACK_MATERIAL]) ok = materialmap.unpack(data, size, header.offset[PACK_MATERIAL]);
+    if (!ok || !check_ranges()) {
+        std::cerr << "bad asset pack " << name << "\n";
+        drop_pack();
+        return false;
+    }
+    bounds_[0] = glm::dvec3(header.bounds[0], header.bounds[1], header.bounds[2]);
+    bounds_[1] = glm::dvec3(header.bounds[3], header.bounds[4], header.bounds[5]);
+    return true;
+}
+
+// done once at load, so that nothing has to be checked while rendering
+bool Model::check_ranges() {
+    size_t nverts = verts_.size();
+    if (norms_.size() != nverts || verts_texture_.size() != nverts || indices_.size() % 3) return false;
+    if ((tangents_.size() && tangents_.size() != nverts) || (tangent_space_ && !tangents_.size())) return false;
+    for (size_t i = 0; i < indices_.size(); i++) {
+        if (indices_[i] >= nverts) return false;
+    }
+    size_t nfaces = indices_.size() / 3;
+    // without lods the whole index buffer is the only one
+    Lod whole = { 0, (int)nfaces, 0, (int)meshlets_.size(), 0.0 };
+    size_t nlods = std::max<size_t>(lods_.size(), 1);
+    for (size_t l = 0; l < nlods; l++) {
+        const Lod& lod = lods_.size() ? lods_[l] : whole;
+        if (lod.face_offset < 0 || lod.face_count < 0 || (size_t)lod.face_offset + lod.face_count > nfaces) return false;
+        if (lod.meshlet_offset < 0 || lod.meshlet_count < 0 || (size_t)lod.meshlet_offset + lod.meshlet_count > meshlets_.size()) return false;
+        for (int i = lod.meshlet_offset; i < lod.meshlet_offset + lod.meshlet_count; i++) {
+            const Meshlet& m = meshlets_[i];
+            if (m.face_offset < 0 || m.face_count < 0 || (size_t)m.face_offset + m.face_count > meshlet_faces_.size()) return false;
+            for (int f = m.face_offset; f < m.face_offset + m.face_count; f++) {
+                if (meshlet_faces_[f] >= (uint32_t)lod.face_count) return false;
+            }
+        }
+    }
+    return true;
+}
@@ -2,35 +2,154 @@
 #define __MODEL_H__
 
 #include <vector>
+#include <memory>
+#include <cstdint>
+#include <future>
 #include "geometry.h"
 #include <glm/glm.hpp>
 #include "tgaimage.h"
+#include "texture.h"
+
+// cluster of nearby faces with bounds for culling whole groups before any vertex is transformed
+struct Meshlet {
+	int face_offset;   // first entry in the model's meshlet face list
+	int face_count;
+	glm::dvec4 sphere; // bounding sphere: center, radius
+	glm::dvec4 cone;   // normal cone: axis, sine of the half angle (> 1 when the cone can't be used for culling)
+};
+
+// level of detail: a range of the index buffer with its own meshlets, see Model::build_lods()
+struct Lod {
+	int face_offset;
+	int face_count;
+	int meshlet_offset;
+	int meshlet_count;
+	double error; // object-space distance the simplification may have moved the surface by, 0 for the source mesh
+};
+
+// material maps sampled at one uv
+struct Material {
+	TGAColor diffuse;
+	glm::dvec3 normal; // unit length when the map is octahedral
+	TGAColor specular;
+	TGAColor glow;
+};
+
+// array owned by the model, or viewed in place in the asset pack the model was mapped from.
+// copies and moves of an owning stream point to their own elements, copies of a view share the viewed memory
+template <typename T>
+class Stream {
+private:
+	std::vector<T> owned_;
+	const T* data_ = nullptr;
+	size_t size_ = 0;
+	bool owns() const { return !owned_.empty() && data_ == owned_.data(); }
+public:
+	Stream() {}
+	Stream(const Stream& s) : owned_(s.owned_), data_(s.owns() ? owned_.data() : s.data_), size_(s.size_) {}
+	Stream(Stream&& s) : owned_(std::move(s.owned_)), data_(s.data_), size_(s.size_) { s.data_ = nullptr; s.size_ = 0; }
+	Stream& operator =(const Stream& s) {
+		if (this != &s) {
+			owned_ = s.owned_;
+			data_ = s.owns() ? owned_.data() : s.data_;
+			size_ = s.size_;
+		}
+		return *this;
+	}
+	Stream& operator =(Stream&& s) {
+		if (this != &s) {
+			owned_ = std::move(s.owned_);
+			data_ = s.data_;
+			size_ = s.size_;
+			s.owned_.clear();
+			s.data_ = nullptr;
+			s.size_ = 0;
+		}
+		return *this;
+	}
+	void assign(std::vector<T>&& v) { owned_ = std::move(v); data_ = owned_.data(); size_ = owned_.size(); }
+	void view(const T* data, size_t size) { owned_.clear(); data_ = data; size_ = size; }
+	size_t size() const { return size_; }
+	const T* data() const { return data_; }
+	const T& operator[](size_t i) const { return data_[i]; }
+};
+
+class MappedFile;
+
+typedef std::shared_future<std::shared_ptr<Texture>> PendingTexture; // map being loaded on the thread pool
 
 class Model {
 private:
-	std::vector<glm::dvec3> verts_;
-	std::vector<glm::dvec3> norms_;
-	std::vector<std::vector<int> > faces_;
-	std::vector<std::vector<int> > verts_texture_idx_;
-	std::vector<glm::dvec3> verts_texture_;
+	Stream<glm::dvec3> verts_;          // unified vertex buffer: one position, uv, normal and tangent per vertex
+	Stream<glm::dvec3> norms_;
+	Stream<glm::dvec3> verts_texture_;
+	Stream<glm::dvec4> tangents_;       // xyz unit tangent, w bitangent sign. empty without a tangent-space normal map
+	Stream<uint32_t> indices_;          // vertex of each triangle corner, 3 per triangle, every lod one after the other
+	Stream<Meshlet> meshlets_;
+	Stream<uint32_t> meshlet_faces_;    // faces of the meshlet's lod
+	Stream<Lod> lods_;                  // empty when there is only the source mesh
+	int lod_;                           // lod the face and meshlet accessors read
+	glm::dvec3 bounds_[2];              // bounding box corners
+	bool tangent_space_;                // normalmap holds tangent-space normals
+	std::shared_ptr<MappedFile> pack_;  // asset pack the streams and textures view, if any
+	std::vector<unsigned char> pack_image_; // same for an asset pack read into memory
+	bool ok_;
+	void parse_obj(const char* begin, const char* end);
+	void weld(const std::vector<glm::dvec3>& positions, const std::vector<glm::dvec3>& uvs, const std::vector<glm::dvec3>& normals, const std::vector<glm::ivec3>& corners);
+	void build_meshlets(std::vector<Meshlet>& meshlets, std::vector<uint32_t>& meshlet_faces); // appends the meshlets of the current lod
+	const uint32_t* corners(int iface);
+	void load_geometry(const char* filename); // parses the obj into the welded streams and bounds
+	void face_tangent(glm::uvec3 idx, glm::ivec3 local, std::vector<glm::dvec3>& tangent_sum, std::vector<glm::dvec3>& bitangent_sum);
+	void finish_tangents(const std::vector<glm::dvec3>& tangent_sum, const std::vector<glm::dvec3>& bitangent_sum);
+	void compute_tangents();
+	bool read_pack(const char* filename);
+	bool view_pack(const unsigned char* data, size_t size, const char* name);
+	void drop_pack();
+	bool check_ranges(); // every index, meshlet and lod of a viewed pack within its stream
 
 public:
-	Model(const char *filename);
+	Model(const char *filename, bool tangent_space = false, bool sparse_textures = false, int texture_level = 0, bool geometry_only = false); // obj file or asset pack
+	Model(Model& parent, const std::vector<int>& faces); // the given faces of parent with the vertices they use, sharing its maps
+	Model(std::vector<unsigned char>&& pack);            // asset pack image already in memory
 	~Model();
+	Model(const Model&) = delete;            // streams may view pack_image_, which a copy wouldn't own
+	Model& operator=(const Model&) = delete;
+	bool ok(); // false when an asset pack couldn't be read, the model is then empty
 	int nverts();
-	int nfaces();
+	int nfaces(); // of the current lod
 	int nvertTex();
-	TGAImage diffusemap{};         // diffuse color texture
-	TGAImage normalmap{};          // normal map texture
-	TGAImage specularmap{};        // specular map texture
-	TGAImage glowmap{};        // specular map texture
+	int nmeshlets();
+	const Meshlet& meshlet(int i);
+	int meshlet_face(int i);
+	// never null, empty when there is no such map
+	std::shared_ptr<Texture> diffusemap = std::make_shared<Texture>();  // diffuse color texture
+	std::shared_ptr<Texture> normalmap = std::make_shared<Texture>();   // normal map texture, object space or tangent space, see tangent_space()
+	std::shared_ptr<Texture> specularmap = std::make_shared<Texture>(); // specular map texture
+	std::shared_ptr<Texture> glowmap = std::make_shared<Texture>();     // glow map texture
+	Texture materialmap{};    // all four maps interleaved per texel, see interleave_materials()
+	glm::dvec3 bounds_min();
+	glm::dvec3 bounds_max();
 	glm::dvec3 vert(int i);
 	glm::dvec3 vert_texture(int i);
 	glm::dvec3 normal(int iface);
 	glm::dvec3 normal(int iface, int nthvert);
-	std::vector<int> face(int idx);
-	std::vector<int> vert_texture_idx(int idx);
-	void load_texture(std::string filename, const std::string suffix, TGAImage& img);
+	glm::dvec4 tangent(int iface, int nthvert);
+	bool tangent_space();
+	int build_lods(int min_faces = 64); // returns how many lods there are, the source mesh included
+	int nlods();
+	double lod_error(int lod);
+	void set_lod(int lod);
+	glm::uvec3 face(int idx);             // position indices of a triangle
+	glm::uvec3 vert_texture_idx(int idx); // uv indices of a triangle
+	std::shared_ptr<Texture> load_texture(std::string filename, const std::string suffix, bool sparse = false, int level = 0);
+	PendingTexture load_texture_async(std::string filename, const std::string suffix, bool sparse = false, int level = 0);
+	int resolve_feedback();
+	void interleave_materials();
+	void encode_normals();
+	void compress_textures();
+	Material material(const Sampler& sampler, glm::dvec2 uv, glm::dmat2 duv);
+	bool write_pack(const char* filename);
+	void pack(std::vector<unsigned char>& file, bool textures = true); // the asset pack image written by write_pack()
 };
 
 #endif //__MODEL_H__
\ No newline at end of file
@@ -1,9 +1,18 @@
+#include <cstdint>
+#include <numeric>
+#include <algorithm>
 #include "our_gl.h"
+#include <glm/gtc/matrix_access.hpp>
 
 glm::dmat4 ModelView_mat;
 glm::dmat4 Projection_mat;
 glm::dmat4 Viewport_mat;
 
+// triangles whose screen bbox is at most this many pixels across take the micro path
+const double micro_triangle_extent = 1.0;
+// triangles covering at least this many pixels are rasterized span by span
+const double span_triangle_area = 64.0;
+
 // About viewport: http://learnwebgl.brown37.net/08_projections/projections_viewport.html
 // https://glasnost.itcarlow.ie/~powerk/GeneralGraphicsNotes/projection/viewport_transformation.html
 // affine transformation: https://en.wikipedia.org/wiki/Affine_transformation
@@ -55,7 +64,110 @@ glm::dvec3 barycentric(glm::dvec3 A, glm::dvec3 B, glm::dvec3 C, glm::dvec3 P) {
     return glm::dvec3(1.0 - (u.x + u.y) / u.z, u.y / u.z, u.x / u.z);
 }
 
+// attributes are interpolated linearly in screen space, so their derivatives are constant over the triangle
+glm::dmat2 uv_gradient(glm::dmat3 screen, glm::dmat3 uv) {
+    glm::dvec2 e1 = glm::dvec2(screen[1] - screen[0]);
+    glm::dvec2 e2 = glm::dvec2(screen[2] - screen[0]);
+    glm::dvec2 d1 = glm::dvec2(uv[1] - uv[0]);
+    glm::dvec2 d2 = glm::dvec2(uv[2] - uv[0]);
+    double det = e1.x * e2.y - e2.x * e1.y;
+    if (std::abs(det) < 1e-12) return glm::dmat2(0.0);
+    return glm::dmat2((d1 * e2.y - d2 * e1.y) / det, (d2 * e1.x - d1 * e2.x) / det);
+}
+
+// resolve one covered pixel against the zbuffer, shading it only if it survives (early-z)
+static void shade_pixel(glm::dvec3* pts, IShader& shader, TGAImage& image, double* zbuffer, int x, int y, glm::dvec3 bc_screen) {
+    // hidden face removal
+    double z = 0.0;
+    for (int i = 0; i < 3; i++) z += pts[i][2] * bc_screen[i];
+    int idx = x + y * image.get_width();
+    if (zbuffer[idx] >= z) return;
+
+    // calculate texture color
+    TGAColor tex_color;
+    if (shader.fragment(bc_screen, tex_color)) return;
+    zbuffer[idx] = z;
+    image.set(x, y, tex_color);
+}
+
+// micro triangles span at most 2x2 pixel centers, so the candidates are tested directly instead of scanning a bbox
+static void triangle_micro(glm::dvec3* pts, IShader& shader, TGAImage& image, double* zbuffer, glm::dvec2 lo, glm::dvec2 hi) {
+    int x0 = std::max(0, (int)std::ceil(lo.x));
+    int y0 = std::max(0, (int)std::ceil(lo.y));
+    int x1 = std::min(image.get_width() - 1, (int)std::floor(hi.x));
+    int y1 = std::min(image.get_height() - 1, (int)std::floor(hi.y));
+    if (x0 > x1 || y0 > y1) return; // the triangle misses every pixel center
+    for (int x = x0; x <= x1; x++) {
+        for (int y = y0; y <= y1; y++) {
+            glm::dvec3 bc_screen = barycentric(pts[0], pts[1], pts[2], glm::dvec3(x, y, 0.0));
+            if (bc_screen.x < 0 || bc_screen.y < 0 || bc_screen.z < 0) continue;
+            shade_pixel(pts, shader, image, zbuffer, x, y, bc_screen);
+        }
+    }
+}
+
+// large triangles: exact left/right span ends per row, then only the covered pixels of each row are visited.
+// ux, uy, uz are the same terms barycentric() computes, evaluated incrementally along the span.
+static void triangle_spans(glm::dvec3* pts, IShader& shader, TGAImage& image, double* zbuffer, glm::dvec2 lo, glm::dvec2 hi, double uz) {
+    const glm::dvec3& A = pts[0];
+    const glm::dvec3& B = pts[1];
+    const glm::dvec3& C = pts[2];
+    double sign = uz > 0.0 ? 1.0 : -1.0;
+
+    // edge functions e(x, y) = a * x + b * y + c, all >= 0 inside the triangle
+    double a[3], b[3], c[3];
+    a[0] = sign * (B.y - A.y); b[0] = sign * (A.x - B.x); c[0] = sign * ((B.x - A.x) * A.y - A.x * (B.y - A.y)); // ux
+    a[1] = sign * (A.y - C.y); b[1] = sign * (C.x - A.x); c[1] = sign * (A.x * (C.y - A.y) - (C.x - A.x) * A.y); // uy
+    a[2] = -a[0] - a[1]; b[2] = -b[0] - b[1]; c[2] = sign * uz - c[0] - c[1];                                     // uz - ux - uy
+
+    // barycentric coordinates step by a constant amount along x
+    glm::dvec3 dbc(-(a[0] + a[1]) * sign / uz, a[1] * sign / uz, a[0] * sign / uz);
+
+    int width = image.get_width();
+    int y0 = std::max(0, (int)std::ceil(lo.y));
+    int y1 = std::min(image.get_height() - 1, (int)std::floor(hi.y));
+    for (int y = y0; y <= y1; y++) {
+        double e[3];
+        double xl = std::max(0.0, std::ceil(lo.x));
+        double xr = std::min(static_cast<double>(width - 1), std::floor(hi.x));
+        for (int i = 0; i < 3; i++) {
+            e[i] = b[i] * y + c[i];
+            if (a[i] > 0.0) xl = std::max(xl, std::ceil(-e[i] / a[i]));
+            else if (a[i] < 0.0) xr = std::min(xr, std::floor(-e[i] / a[i]));
+            else if (e[i] < 0.0) xr = xl - 1.0;
+        }
+        // guard the ends against rounding for non-integer vertices
+        auto inside = [&](double x) { return a[0] * x + e[0] >= 0.0 && a[1] * x + e[1] >= 0.0 && a[2] * x + e[2] >= 0.0; };
+        while (xl <= xr && !inside(xl)) xl += 1.0;
+        while (xr >= xl && !inside(xr)) xr -= 1.0;
+        if (xl > xr) continue;
+
+        double ux = sign * (a[0] * xl + e[0]);
+        double uy = sign * (a[1] * xl + e[1]);
+        glm::dvec3 bc_screen(1.0 - (ux + uy) / uz, uy / uz, ux / uz);
+        for (int x = (int)xl; x <= (int)xr; x++) {
+            shade_pixel(pts, shader, image, zbuffer, x, y, bc_screen);
+            bc_screen += dbc;
+        }
+    }
+}
+
 void triangle(glm::dvec3* pts, IShader& shader, TGAImage& image, double* zbuffer) {
+    // classify by screen area: degenerate and off-screen triangles are dropped before any setup
+    double area = (pts[2].x - pts[0].x) * (pts[1].y - pts[0].y) - (pts[1].x - pts[0].x) * (pts[2].y - pts[0].y);
+    if (std::abs(area) < 1e-3) return; // same threshold barycentric() uses to reject degenerate triangles
+    glm::dvec2 lo = glm::min(glm::min(glm::dvec2(pts[0]), glm::dvec2(pts[1])), glm::dvec2(pts[2]));
+    glm::dvec2 hi = glm::max(glm::max(glm::dvec2(pts[0]), glm::dvec2(pts[1])), glm::dvec2(pts[2]));
+    if (hi.x < 0.0 || hi.y < 0.0 || lo.x > image.get_width() - 1 || lo.y > image.get_height() - 1) return;
+    if (hi.x - lo.x <= micro_triangle_extent && hi.y - lo.y <= micro_triangle_extent) {
+        triangle_micro(pts, shader, image, zbuffer, lo, hi);
+        return;
+    }
+    if (std::abs(area) * 0.5 >= span_triangle_area) {
+        triangle_spans(pts, shader, image, zbuffer, lo, hi, area);
+        return;
+    }
+
     glm::dvec2 bboxmin(std::numeric_limits<double>::max(), std::numeric_limits<double>::max());
     glm::dvec2 bboxmax(std::numeric_limits<double>::min(), std::numeric_limits<double>::min());
     glm::dvec2 clamp(static_cast<double>(image.get_width() - 1), static_cast<double>(image.get_height() - 1));
@@ -71,20 +183,83 @@ void triangle(glm::dvec3* pts, IShader& shader, TGAImage& image, double* zbuffer
             // check if a point is in the triangle
             glm::dvec3 bc_screen = barycentric(pts[0], pts[1], pts[2], P);
             if (bc_screen.x < 0 || bc_screen.y < 0 || bc_screen.z < 0) continue;
+            shade_pixel(pts, shader, image, zbuffer, int(P.x), int(P.y), bc_screen);
+        }
+    }
+}
 
-            // calculate texture color
-            TGAColor tex_color;
-            shader.fragment(bc_screen, tex_color);
-
-            // hidden face removal
-            P.z = 0.0;
-            for (int i = 0; i < 3; i++) P.z += pts[i][2] * bc_screen[i];
-            int idx = int(P.x + P.y * image.get_width());
-            if (zbuffer[idx] < P.z) {
-                zbuffer[idx] = P.z;
-                image.set(P.x, P.y, tex_color);
+// the camera is the point the projection sends to x = y = w = 0: the null space of those three rows of M.
+// w comes out as 0 for orthographic projections, the xyz part is then the viewing direction up to sign.
+static glm::dvec4 camera_origin(const glm::dmat4& M) {
+    glm::dvec4 rows[3] = { glm::row(M, 0), glm::row(M, 1), glm::row(M, 3) };
+    glm::dvec4 origin;
+    for (int i = 0; i < 4; i++) {
+        glm::dmat3 minor;
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0, k = 0; c < 4; c++) {
+                if (c != i) minor[k++][r] = rows[r][c];
             }
         }
+        origin[i] = (i % 2 ? -1.0 : 1.0) * glm::determinant(minor);
+    }
+    return origin;
+}
+
+// conservative test of a bounding sphere against the screen rectangle, and of a normal cone against the camera
+bool cluster_visible(glm::dvec4 sphere, glm::dvec4 cone, int width, int height, bool cull_backfaces) {
+    glm::dmat4 M = Viewport_mat * Projection_mat * ModelView_mat;
+    glm::dvec3 center(sphere);
+    double radius = sphere.w;
+
+    // screen space x = X/W in [0, width] and y = Y/W in [0, height] are planes in object space
+    glm::dvec4 X = glm::row(M, 0), Y = glm::row(M, 1), W = glm::row(M, 3);
+    glm::dvec4 planes[5] = { X, W * static_cast<double>(width) - X, Y, W * static_cast<double>(height) - Y, W };
+    for (int i = 0; i < 5; i++) {
+        double len = glm::length(glm::dvec3(planes[i]));
+        double dist = glm::dot(glm::dvec3(planes[i]), center) + planes[i].w;
+        if (len < 1e-12) {
+            if (dist < 0.0) return false;
+            continue;
+        }
+        if (dist / len < -radius) return false;
+    }
+
+    if (!cull_backfaces || cone.w > 1.0) return true;
+    glm::dvec3 axis(cone);
+    glm::dvec4 origin = camera_origin(Projection_mat * ModelView_mat);
+    if (std::abs(origin.w) > 1e-12) {
+        glm::dvec3 view = center - glm::dvec3(origin) / origin.w;
+        return glm::dot(view, axis) < cone.w * glm::length(view) + radius;
+    }
+    // orthographic: depth grows towards the viewer, so the view direction points the other way
+    glm::dvec3 view = glm::normalize(glm::dvec3(origin));
+    if (glm::dot(glm::dvec3(glm::row(M, 2)), view) > 0.0) view = -view;
+    return glm::dot(view, axis) < cone.w;
+}
+
+// LSD radix sort on depths quantized to 16 bits, two 8-bit digits
+void depth_sort(const std::vector<double>& depths, DepthOrder order, std::vector<int>& sorted) {
+    int n = (int)depths.size();
+    sorted.resize(n);
+    std::iota(sorted.begin(), sorted.end(), 0);
+    if (order == UNSORTED || n < 2) return;
+
+    auto range = std::minmax_element(depths.begin(), depths.end());
+    double lo = *range.first;
+    double scale = *range.second > lo ? 65535.0 / (*range.second - lo) : 0.0;
+    std::vector<uint16_t> keys(n);
+    for (int i = 0; i < n; i++) {
+        uint16_t k = static_cast<uint16_t>((depths[i] - lo) * scale);
+        keys[i] = order == FRONT_TO_BACK ? 65535 - k : k; // closest first means largest depth first
+    }
+
+    std::vector<int> tmp(n);
+    for (int shift = 0; shift < 16; shift += 8) {
+        int count[257] = { 0 };
+        for (int i = 0; i < n; i++) count[((keys[i] >> shift) & 0xff) + 1]++;
+        for (int d = 0; d < 256; d++) count[d + 1] += count[d];
+        for (int i = 0; i < n; i++) tmp[count[(keys[sorted[i]] >> shift) & 0xff]++] = sorted[i];
+        sorted.swap(tmp);
     }
 }
 
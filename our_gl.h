@@ -1,3 +1,4 @@
+#include <vector>
 #include "tgaimage.h"
 #include <glm/glm.hpp>
 
@@ -11,6 +12,11 @@ struct IShader {
     virtual bool fragment(glm::dvec3 baryCoord, TGAColor& color) = 0; // function to determine the color of the current pixel and discard vertices
 };
 
+// order in which faces (or clusters of faces) are submitted to triangle()
+enum DepthOrder {
+    UNSORTED, FRONT_TO_BACK, BACK_TO_FRONT
+};
+
 void line(int x0, int y0, int x1, int y1, TGAImage& image, TGAColor color);
 
 void viewport(double x, double y, double w, double h, double d);
@@ -22,3 +28,9 @@ void projection(double cameraZ);
 void triangle(glm::dvec3* pts, IShader& shader, TGAImage& out_image, double* zbuffer);
 
 glm::dvec3 barycentric(glm::dvec3 A, glm::dvec3 B, glm::dvec3 C, glm::dvec3 P);
+
+glm::dmat2 uv_gradient(glm::dmat3 screen, glm::dmat3 uv); // derivatives of uv along screen x and y over a triangle
+
+void depth_sort(const std::vector<double>& depths, DepthOrder order, std::vector<int>& sorted); // larger depth is closer, as in the zbuffer
+
+bool cluster_visible(glm::dvec4 sphere, glm::dvec4 cone, int width, int height, bool cull_backfaces); // object-space bounds against the current matrices
@@ -0,0 +1,75 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include "scene.h"
+#include "model.h"
+#include <glm/gtc/matrix_transform.hpp>
+
+Scene::Scene() : camera_pos(2, 2, 5), camera_eye(0, 0, 0), light_pos(0, 1, 1) {}
+
+Scene::~Scene() {}
+
+// unknown records are skipped, as in obj files
+bool Scene::load(const char* filename, const std::function<Model*(const std::string& path)>& load_model) {
+    std::ifstream in(filename);
+    if (!in.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    std::string line;
+    int lineno = 0;
+    while (std::getline(in, line)) {
+        lineno++;
+        std::istringstream iss(line);
+        std::string record;
+        if (!(iss >> record) || record[0] == '#') continue;
+        if (record == "camera" || record == "eye" || record == "light") {
+            glm::dvec3 v;
+            if (!(iss >> v.x >> v.y >> v.z)) {
+                std::cerr << filename << ":" << lineno << ": expected three coordinates\n";
+                continue;
+            }
+            (record == "camera" ? camera_pos : record == "eye" ? camera_eye : light_pos) = v;
+        }
+        else if (record == "model") {
+            Entry entry;
+            if (!(iss >> entry.name >> entry.path)) {
+                std::cerr << filename << ":" << lineno << ": expected a name and a path\n";
+                continue;
+            }
+            entry.model.reset(load_model(entry.path));
+            if (entry.model) models.push_back(std::move(entry));
+        }
+        else if (record == "instance") {
+            std::string name;
+            iss >> name;
+            int m = (int)models.size() - 1;
+            while (m >= 0 && models[m].name != name) m--;
+            if (m < 0) {
+                std::cerr << filename << ":" << lineno << ": no model " << name << "\n";
+                continue;
+            }
+            double values[7] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0 };
+            for (int i = 0; i < 7 && iss >> values[i]; i++) {}
+            glm::dmat4 transform = glm::translate(glm::dmat4(1.0), glm::dvec3(values[0], values[1], values[2]));
+            for (int axis = 2; axis >= 0; axis--) {
+                glm::dvec3 a(0.0);
+                a[axis] = 1.0;
+                transform = glm::rotate(transform, glm::radians(values[3 + axis]), a);
+            }
+            transform = glm::scale(transform, glm::dvec3(values[6]));
+            instances.push_back({ m, transform, 0 });
+        }
+    }
+    std::cerr << "# scene " << filename << " models " << models.size() << " instances " << instances.size() << std::endl;
+    return true;
+}
+
+void Scene::add(Model* model, const std::string& name, const glm::dmat4& transform) {
+    Entry entry;
+    entry.name = name;
+    entry.path = name;
+    entry.model.reset(model);
+    models.push_back(std::move(entry));
+    instances.push_back({ (int)models.size() - 1, transform, 0 });
+}
@@ -0,0 +1,47 @@
+#ifndef __SCENE_H__
+#define __SCENE_H__
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+#include <glm/glm.hpp>
+
+class Model;
+
+// one placement of a scene model
+struct Instance {
+    int model;            // index in Scene::models
+    glm::dmat4 transform; // object space to world space
+    int lod;              // lod drawn by every pass, see Model::set_lod()
+};
+
+// models loaded once each and placed any number of times, seen from one camera and lit by one light.
+// text format, one record per line, # starts a comment:
+//   camera x y z                        camera position
+//   eye x y z                           point looked at
+//   light x y z                         light position
+//   model name path                     path without the .obj extension, as given on the command line
+//   instance name tx ty tz rx ry rz s   translation, rotation in degrees about x then y then z, uniform scale.
+//                                       values left out are 0 and a scale of 1
+class Scene {
+public:
+    struct Entry {
+        std::string name;
+        std::string path;
+        std::unique_ptr<Model> model;
+    };
+    std::vector<Entry> models;
+    std::vector<Instance> instances;
+    glm::dvec3 camera_pos;
+    glm::dvec3 camera_eye;
+    glm::dvec3 light_pos;
+
+    Scene();
+    ~Scene();
+    // load_model is called once per model record, instances of models it fails to load are dropped
+    bool load(const char* filename, const std::function<Model*(const std::string& path)>& load_model);
+    void add(Model* model, const std::string& name, const glm::dmat4& transform = glm::dmat4(1.0)); // one more model with a single instance
+};
+
+#endif //__SCENE_H__
@@ -0,0 +1,680 @@
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include "texture.h"
+
+const int tile_bits = 3; // 8x8 texel tiles
+const int tile_size = 1 << tile_bits;
+const int tile_mask = tile_size - 1;
+const int morton_bits[tile_size] = { 0, 1, 4, 5, 16, 17, 20, 21 }; // bits of a tile coordinate spread to even positions
+
+// tile file: header, then the tiles of each level in the TILED layout, finest level first
+struct TileFileHeader {
+    char magic[4];
+    int version;
+    int width;
+    int height;
+    int bytespp;
+    int levels;
+    int octahedral;
+};
+const int tile_file_version = 1;
+const int resident_tail_tiles = 16; // levels of at most this many tiles are read whole when a tile file is opened
+const int tile_missing = -1;
+const int tile_requested = -2;
+
+// asset pack layout of a texture: this descriptor, one PackedLevel per level, then the texels of each level
+struct PackedTexture {
+    int32_t bytespp;
+    int32_t layout;
+    int32_t format;
+    int32_t octahedral;
+    int32_t levels;
+    int32_t pad;
+};
+struct PackedLevel {
+    int32_t width;
+    int32_t height;
+    int32_t tiles_x;
+    int32_t pad;
+    uint64_t offset; // from the start of the file
+    uint64_t bytes;
+};
+
+static const unsigned char* level_texels(const TextureLevel& l) {
+    return l.mapped ? l.mapped : l.data.data();
+}
+
+Texture::Texture() : levels_(), bytespp(0), layout(LINEAR), format(RAW), octahedral(-1), tile_file(), feedback_() {
+}
+
+inline int Texture::texel_index(const TextureLevel& l, int x, int y) {
+    if (layout == LINEAR) return x + y * l.width;
+    int tile = (x >> tile_bits) + (y >> tile_bits) * l.tiles_x;
+    if (!l.tile_slots.empty() && (tile = l.tile_slots[tile]) < 0) return -1;
+    return (tile << (2 * tile_bits)) | morton_bits[x & tile_mask] | (morton_bits[y & tile_mask] << 1);
+}
+
+// reorders a row-major level into the texture's layout, padding it to whole tiles
+static void swizzle(TextureLevel& l, Texture::Layout layout, int bytespp) {
+    l.tiles_x = (l.width + tile_mask) >> tile_bits;
+    if (layout == Texture::LINEAR) return;
+    int tiles_y = (l.height + tile_mask) >> tile_bits;
+    std::vector<unsigned char> tiled(l.tiles_x * tiles_y * tile_size * tile_size * bytespp, 0);
+    for (int y = 0; y < l.height; y++) {
+        for (int x = 0; x < l.width; x++) {
+            int tile = (x >> tile_bits) + (y >> tile_bits) * l.tiles_x;
+            int idx = (tile << (2 * tile_bits)) | morton_bits[x & tile_mask] | (morton_bits[y & tile_mask] << 1);
+            for (int c = 0; c < bytespp; c++) tiled[idx * bytespp + c] = l.data[(x + y * l.width) * bytespp + c];
+        }
+    }
+    l.data.swap(tiled);
+}
+
+// level 0 is a copy of the image, each next level a 2x2 box filter of the previous one down to 1x1.
+// levels are filtered row by row and reordered into the requested layout once the chain is complete.
+void Texture::build(TGAImage& img, Layout layout) {
+    build(img.buffer(), img.get_width(), img.get_height(), img.get_bytespp(), layout);
+}
+
+void Texture::build(const unsigned char* data, int width, int height, int bytespp, Layout layout, int octahedral) {
+    levels_.clear();
+    this->bytespp = bytespp;
+    this->layout = layout;
+    this->octahedral = octahedral;
+    format = RAW;
+    tile_file.clear();
+    feedback_.clear();
+    if (!data) return;
+
+    TextureLevel base;
+    base.width = width;
+    base.height = height;
+    base.data.assign(data, data + width * height * bytespp);
+    levels_.push_back(std::move(base));
+
+    while (levels_.back().width > 1 || levels_.back().height > 1) {
+        const TextureLevel& src = levels_.back();
+        TextureLevel dst;
+        dst.width = std::max(1, src.width / 2);
+        dst.height = std::max(1, src.height / 2);
+        dst.data.resize(dst.width * dst.height * bytespp);
+        for (int y = 0; y < dst.height; y++) {
+            int y0 = std::min(2 * y, src.height - 1);
+            int y1 = std::min(2 * y + 1, src.height - 1);
+            for (int x = 0; x < dst.width; x++) {
+                int x0 = std::min(2 * x, src.width - 1);
+                int x1 = std::min(2 * x + 1, src.width - 1);
+                const unsigned char* t[4] = {
+                    &src.data[(x0 + y0 * src.width) * bytespp], &src.data[(x1 + y0 * src.width) * bytespp],
+                    &src.data[(x0 + y1 * src.width) * bytespp], &src.data[(x1 + y1 * src.width) * bytespp]
+                };
+                unsigned char* out = &dst.data[(x + y * dst.width) * bytespp];
+                for (int c = 0; c < bytespp; c++) {
+                    out[c] = (unsigned char)((t[0][c] + t[1][c] + t[2][c] + t[3][c] + 2) / 4);
+                }
+                // octahedral normals are averaged as vectors
+                if (octahedral >= 0) {
+                    glm::dvec3 n(0.0);
+                    for (int i = 0; i < 4; i++) n += decode_octahedral(t[i] + octahedral);
+                    encode_octahedral(glm::length(n) > 1e-12 ? glm::normalize(n) : glm::dvec3(0.0, 0.0, 1.0), out + octahedral);
+                }
+            }
+        }
+        levels_.push_back(std::move(dst));
+    }
+    for (TextureLevel& l : levels_) swizzle(l, layout, bytespp);
+}
+
+// inverse of swizzle(): texels are gathered a tile row at a time
+bool Texture::read_rows(int level, unsigned char* dst) {
+    if (format != RAW || level < 0 || level >= levels() || !levels_[level].tile_slots.empty()) return false;
+    const TextureLevel& l = levels_[level];
+    const unsigned char* src = level_texels(l);
+    if (layout == LINEAR) {
+        memcpy(dst, src, (size_t)l.width * l.height * bytespp);
+        return true;
+    }
+    for (int y = 0; y < l.height; y++) {
+        unsigned char* row = dst + (size_t)y * l.width * bytespp;
+        for (int x = 0; x < l.width; x++) {
+            int tile = (x >> tile_bits) + (y >> tile_bits) * l.tiles_x;
+            int idx = (tile << (2 * tile_bits)) | morton_bits[x & tile_mask] | (morton_bits[y & tile_mask] << 1);
+            memcpy(row + x * bytespp, src + idx * bytespp, bytespp);
+        }
+    }
+    return true;
+}
+
+int Texture::levels() {
+    return (int)levels_.size();
+}
+
+int Texture::get_width(int level) {
+    return levels_.empty() ? 0 : levels_[level].width;
+}
+
+int Texture::get_height(int level) {
+    return levels_.empty() ? 0 : levels_[level].height;
+}
+
+int Texture::get_bytespp() {
+    return bytespp;
+}
+
+Texture::Layout Texture::get_layout() {
+    return layout;
+}
+
+Texture::Format Texture::get_format() {
+    return format;
+}
+
+int Texture::get_octahedral() {
+    return octahedral;
+}
+
+size_t Texture::size() {
+    size_t bytes = 0;
+    for (const TextureLevel& l : levels_) bytes += l.data.size(); // mapped texels are file pages, not counted
+    return bytes;
+}
+
+// block compression, see https://learn.microsoft.com/en-us/windows/win32/direct3d10/d3d10-graphics-programming-guide-resources-block-compression
+static int bc_block_bytes(Texture::Format f) {
+    return f == Texture::BC5 ? 16 : 8;
+}
+
+static void expand_565(unsigned short c, int* bgr) {
+    int b = c & 31, g = (c >> 5) & 63, r = c >> 11;
+    bgr[0] = (b << 3) | (b >> 2);
+    bgr[1] = (g << 2) | (g >> 4);
+    bgr[2] = (r << 3) | (r >> 2);
+}
+
+static unsigned short pack_565(const double* bgr) {
+    int b = std::clamp((int)std::lround(bgr[0] * 31.0 / 255.0), 0, 31);
+    int g = std::clamp((int)std::lround(bgr[1] * 63.0 / 255.0), 0, 63);
+    int r = std::clamp((int)std::lround(bgr[2] * 31.0 / 255.0), 0, 31);
+    return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+// the four colors of a BC1 block, three and transparent black when c0 <= c1
+static void bc1_palette(unsigned short c0, unsigned short c1, int palette[4][3]) {
+    expand_565(c0, palette[0]);
+    expand_565(c1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+        if (c0 > c1) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c] + 1) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c] + 1) / 3;
+        }
+        else {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        }
+    }
+}
+
+// the eight values of a BC4 block
+static void bc4_palette(int a0, int a1, int palette[8]) {
+    palette[0] = a0;
+    palette[1] = a1;
+    if (a0 > a1) {
+        for (int i = 2; i < 8; i++) palette[i] = ((8 - i) * a0 + (i - 1) * a1 + 3) / 7;
+    }
+    else {
+        for (int i = 2; i < 6; i++) palette[i] = ((6 - i) * a0 + (i - 1) * a1 + 2) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+// endpoints are the extreme texels along the principal axis of the block's colors
+static void encode_bc1(const double texels[16][max_texel_channels], unsigned char* block) {
+    double mean[3] = { 0.0, 0.0, 0.0 };
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 3; c++) mean[c] += texels[i][c] / 16.0;
+    }
+    double cov[3][3] = { { 0.0 } };
+    for (int i = 0; i < 16; i++) {
+        for (int a = 0; a < 3; a++) {
+            for (int b = 0; b < 3; b++) cov[a][b] += (texels[i][a] - mean[a]) * (texels[i][b] - mean[b]);
+        }
+    }
+    double axis[3] = { 1.0, 1.0, 1.0 };
+    for (int it = 0; it < 8; it++) {
+        double next[3];
+        for (int a = 0; a < 3; a++) next[a] = cov[a][0] * axis[0] + cov[a][1] * axis[1] + cov[a][2] * axis[2];
+        double len = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+        if (len < 1e-9) break;
+        for (int a = 0; a < 3; a++) axis[a] = next[a] / len;
+    }
+    int lo = 0, hi = 0;
+    double dmin = 1e30, dmax = -1e30;
+    for (int i = 0; i < 16; i++) {
+        double d = 0.0;
+        for (int c = 0; c < 3; c++) d += (texels[i][c] - mean[c]) * axis[c];
+        if (d < dmin) dmin = d, lo = i;
+        if (d > dmax) dmax = d, hi = i;
+    }
+    double e0[3], e1[3];
+    for (int c = 0; c < 3; c++) e0[c] = texels[hi][c], e1[c] = texels[lo][c];
+    unsigned short c0 = pack_565(e0), c1 = pack_565(e1);
+    if (c0 < c1) std::swap(c0, c1);
+
+    int palette[4][3];
+    bc1_palette(c0, c1, palette);
+    unsigned int indices = 0;
+    for (int i = 0; i < 16 && c0 != c1; i++) {
+        int best = 0;
+        double best_dist = 1e30;
+        for (int k = 0; k < 4; k++) {
+            double dist = 0.0;
+            for (int c = 0; c < 3; c++) dist += (texels[i][c] - palette[k][c]) * (texels[i][c] - palette[k][c]);
+            if (dist < best_dist) best_dist = dist, best = k;
+        }
+        indices |= best << (2 * i);
+    }
+    block[0] = c0 & 0xff; block[1] = c0 >> 8;
+    block[2] = c1 & 0xff; block[3] = c1 >> 8;
+    for (int i = 0; i < 4; i++) block[4 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+static void encode_bc4(const double texels[16][max_texel_channels], int channel, unsigned char* block) {
+    int a0 = 0, a1 = 255;
+    for (int i = 0; i < 16; i++) {
+        a0 = std::max(a0, (int)std::lround(texels[i][channel]));
+        a1 = std::min(a1, (int)std::lround(texels[i][channel]));
+    }
+    int palette[8];
+    bc4_palette(a0, a1, palette);
+    unsigned long long indices = 0;
+    for (int i = 0; i < 16 && a0 != a1; i++) {
+        int best = 0;
+        for (int k = 1; k < 8; k++) {
+            if (std::abs(texels[i][channel] - palette[k]) < std::abs(texels[i][channel] - palette[best])) best = k;
+        }
+        indices |= (unsigned long long)best << (3 * i);
+    }
+    block[0] = a0;
+    block[1] = a1;
+    for (int i = 0; i < 6; i++) block[2 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+static int decode_bc4(const unsigned char* block, int i) {
+    int palette[8];
+    bc4_palette(block[0], block[1], palette);
+    unsigned long long indices = 0;
+    for (int k = 0; k < 6; k++) indices |= (unsigned long long)block[2 + k] << (8 * k);
+    return palette[(indices >> (3 * i)) & 7];
+}
+
+// re-encodes every level into 4x4 blocks, reading the current texels through fetch()
+bool Texture::compress(Format f) {
+    if (f == RAW || format != RAW || octahedral >= 0 || sparse() || !levels_.size()) return false;
+    if ((f == BC1 || f == BC5) && bytespp < 3) return false;
+    int block_bytes = bc_block_bytes(f);
+    for (int level = 0; level < levels(); level++) {
+        TextureLevel& l = levels_[level];
+        int blocks_x = (l.width + 3) / 4;
+        int blocks_y = (l.height + 3) / 4;
+        std::vector<unsigned char> blocks(blocks_x * blocks_y * block_bytes);
+        double texels[16][max_texel_channels];
+        for (int by = 0; by < blocks_y; by++) {
+            for (int bx = 0; bx < blocks_x; bx++) {
+                for (int i = 0; i < 16; i++) {
+                    fetch(level, std::min(bx * 4 + i % 4, l.width - 1), std::min(by * 4 + i / 4, l.height - 1), texels[i]);
+                }
+                unsigned char* block = blocks.data() + (bx + by * blocks_x) * block_bytes;
+                if (f == BC1) encode_bc1(texels, block);
+                else if (f == BC4) encode_bc4(texels, 0, block);
+                else {
+                    encode_bc4(texels, 2, block);
+                    encode_bc4(texels, 1, block + 8);
+                }
+            }
+        }
+        l.tiles_x = blocks_x;
+        l.data.swap(blocks);
+        l.mapped = nullptr;
+        l.mapped_size = 0;
+    }
+    format = f;
+    bytespp = (f == BC4 ? 1 : 3);
+    return true;
+}
+
+void Texture::drop_levels(int count) {
+    count = std::min(count, levels() - 1);
+    if (count > 0) levels_.erase(levels_.begin(), levels_.begin() + count);
+}
+
+bool Texture::fetch(int level, int x, int y, double* texel) {
+    const TextureLevel& l = levels_[level];
+    if (x < 0 || y < 0 || x >= l.width || y >= l.height) return false;
+    if (format == RAW) {
+        int idx = texel_index(l, x, y);
+        if (idx < 0) {
+            // tile not resident: request it and read the next coarser level, the mip tail always being resident
+            int tile = (x >> tile_bits) + (y >> tile_bits) * l.tiles_x;
+            int& slot = levels_[level].tile_slots[tile];
+            if (slot == tile_missing) {
+                slot = tile_requested;
+                feedback_.push_back((uint32_t)level << 24 | tile);
+            }
+            const TextureLevel& next = levels_[level + 1];
+            return fetch(level + 1, std::min(x >> 1, next.width - 1), std::min(y >> 1, next.height - 1), texel);
+        }
+        const unsigned char* t = level_texels(l) + idx * bytespp;
+        for (int c = 0; c < bytespp; c++) texel[c] = t[c];
+        if (octahedral >= 0) {
+            glm::dvec3 n = decode_octahedral(t + octahedral);
+            for (int c = 0; c < 3; c++) texel[octahedral + c] = n[c];
+            texel[octahedral + 3] = 0.0;
+        }
+        return true;
+    }
+
+    const unsigned char* block = level_texels(l) + ((x >> 2) + (y >> 2) * l.tiles_x) * bc_block_bytes(format);
+    int i = (x & 3) + (y & 3) * 4;
+    if (format == BC1) {
+        int palette[4][3];
+        bc1_palette(block[0] | (block[1] << 8), block[2] | (block[3] << 8), palette);
+        int k = (block[4 + i / 4] >> (2 * (i % 4))) & 3;
+        for (int c = 0; c < 3; c++) texel[c] = palette[k][c];
+    }
+    else if (format == BC4) {
+        texel[0] = decode_bc4(block, i);
+    }
+    else {
+        texel[2] = decode_bc4(block, i);
+        texel[1] = decode_bc4(block + 8, i);
+        double nx = texel[2] / 255.0 * 2.0 - 1.0;
+        double ny = texel[1] / 255.0 * 2.0 - 1.0;
+        double nz = std::sqrt(std::max(0.0, 1.0 - nx * nx - ny * ny));
+        texel[0] = std::round((nz + 1.0) * 0.5 * 255.0);
+    }
+    return true;
+}
+
+bool Texture::write_tiles(const char* filename) {
+    if (format != RAW || layout != TILED || sparse() || !levels_.size()) return false;
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    TileFileHeader header = { { 'T', 'I', 'L', 'E' }, tile_file_version, levels_[0].width, levels_[0].height, bytespp, levels(), octahedral };
+    out.write((const char*)&header, sizeof(header));
+    for (const TextureLevel& l : levels_) out.write((const char*)level_texels(l), l.mapped ? l.mapped_size : l.data.size());
+    if (!out.good()) {
+        std::cerr << "can't dump the tile file\n";
+        return false;
+    }
+    return true;
+}
+
+// levels larger than the mip tail get a slot table and no texels: their tiles are appended to data as they are resolved
+bool Texture::open_tiles(const char* filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.is_open()) return false;
+    TileFileHeader header;
+    in.read((char*)&header, sizeof(header));
+    if (!in.good() || memcmp(header.magic, "TILE", 4) || header.version != tile_file_version || header.levels < 1) {
+        std::cerr << "bad tile file " << filename << "\n";
+        return false;
+    }
+    levels_.clear();
+    bytespp = header.bytespp;
+    layout = TILED;
+    format = RAW;
+    octahedral = header.octahedral;
+    feedback_.clear();
+
+    int tile_bytes = tile_size * tile_size * bytespp;
+    long long offset = sizeof(header);
+    int w = header.width, h = header.height;
+    for (int i = 0; i < header.levels; i++) {
+        TextureLevel l;
+        l.width = w;
+        l.height = h;
+        l.tiles_x = (w + tile_mask) >> tile_bits;
+        int ntiles = l.tiles_x * ((h + tile_mask) >> tile_bits);
+        l.file_offset = offset;
+        offset += (long long)ntiles * tile_bytes;
+        if (ntiles <= resident_tail_tiles || i == header.levels - 1) {
+            l.data.resize(ntiles * tile_bytes);
+            in.seekg(l.file_offset);
+            in.read((char*)l.data.data(), l.data.size());
+            if (!in.good()) {
+                std::cerr << "an error occured while reading the tile file\n";
+                levels_.clear();
+                return false;
+            }
+        }
+        else {
+            l.tile_slots.assign(ntiles, tile_missing);
+        }
+        levels_.push_back(std::move(l));
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+    }
+    tile_file = filename;
+    return true;
+}
+
+bool Texture::sparse() {
+    return !tile_file.empty();
+}
+
+int Texture::feedback() {
+    return (int)feedback_.size();
+}
+
+// requests sort by level then tile, which is file order, so the reads move forward through the file
+int Texture::resolve_feedback() {
+    if (feedback_.empty()) return 0;
+    std::ifstream in(tile_file, std::ios::binary);
+    if (!in.is_open()) {
+        std::cerr << "can't open file " << tile_file << "\n";
+        return 0;
+    }
+    std::sort(feedback_.begin(), feedback_.end());
+    int tile_bytes = tile_size * tile_size * bytespp;
+    int loaded = 0;
+    for (uint32_t request : feedback_) {
+        TextureLevel& l = levels_[request >> 24];
+        int tile = request & 0xffffff;
+        size_t slot = l.data.size() / tile_bytes;
+        l.data.resize(l.data.size() + tile_bytes);
+        in.seekg(l.file_offset + (long long)tile * tile_bytes);
+        in.read((char*)l.data.data() + slot * tile_bytes, tile_bytes);
+        if (!in.good()) {
+            in.clear();
+            l.data.resize(slot * tile_bytes);
+            l.tile_slots[tile] = tile_missing;
+            continue;
+        }
+        l.tile_slots[tile] = (int)slot;
+        loaded++;
+    }
+    feedback_.clear();
+    return loaded;
+}
+
+void pack_align(std::vector<unsigned char>& file) {
+    file.resize((file.size() + pack_alignment - 1) / pack_alignment * pack_alignment, 0);
+}
+
+size_t Texture::pack(std::vector<unsigned char>& file) {
+    if (sparse() || !levels_.size()) return 0;
+    pack_align(file);
+    size_t start = file.size();
+    PackedTexture t = { bytespp, layout, format, octahedral, levels(), 0 };
+    file.insert(file.end(), (const unsigned char*)&t, (const unsigned char*)&t + sizeof(t));
+    size_t table = file.size();
+    file.resize(table + levels_.size() * sizeof(PackedLevel));
+    for (size_t i = 0; i < levels_.size(); i++) {
+        const TextureLevel& l = levels_[i];
+        size_t bytes = l.mapped ? l.mapped_size : l.data.size();
+        pack_align(file);
+        PackedLevel pl = { l.width, l.height, l.tiles_x, 0, file.size(), bytes };
+        file.insert(file.end(), level_texels(l), level_texels(l) + bytes);
+        memcpy(&file[table + i * sizeof(PackedLevel)], &pl, sizeof(pl));
+    }
+    return start;
+}
+
+// bytes a level of the given size takes, with tiles_x as the texture itself would compute it
+static bool level_bytes(const PackedTexture& t, const PackedLevel& l, size_t& bytes) {
+    if (l.width < 1 || l.height < 1) return false;
+    if (t.format != Texture::RAW) {
+        int blocks_x = (l.width + 3) / 4;
+        if (l.tiles_x != blocks_x) return false;
+        bytes = (size_t)blocks_x * ((l.height + 3) / 4) * bc_block_bytes((Texture::Format)t.format);
+    } else if (t.layout == Texture::TILED) {
+        int tiles_x = (l.width + tile_mask) >> tile_bits;
+        if (l.tiles_x != tiles_x) return false;
+        bytes = (size_t)tiles_x * ((l.height + tile_mask) >> tile_bits) * tile_size * tile_size * t.bytespp;
+    } else {
+        bytes = (size_t)l.width * l.height * t.bytespp;
+    }
+    return true;
+}
+
+bool Texture::unpack(const unsigned char* file, size_t file_size, size_t offset) {
+    PackedTexture t;
+    if (offset > file_size || file_size - offset < sizeof(t)) return false;
+    memcpy(&t, file + offset, sizeof(t));
+    if (t.levels < 1 || t.levels > 32 || t.bytespp < 1 || t.bytespp > max_texel_channels) return false;
+    if (t.layout < LINEAR || t.layout > TILED || t.format < RAW || t.format > BC5) return false;
+    if (t.format != RAW && (t.bytespp != (t.format == BC4 ? 1 : 3) || t.octahedral >= 0)) return false;
+    if (t.octahedral < -1 || t.octahedral + 2 > t.bytespp) return false;
+    if (file_size - offset - sizeof(t) < t.levels * sizeof(PackedLevel)) return false;
+    std::vector<TextureLevel> levels(t.levels);
+    for (int i = 0; i < t.levels; i++) {
+        PackedLevel pl;
+        memcpy(&pl, file + offset + sizeof(t) + i * sizeof(PackedLevel), sizeof(pl));
+        size_t bytes;
+        if (!level_bytes(t, pl, bytes) || pl.bytes != bytes || pl.offset > file_size || file_size - pl.offset < pl.bytes) return false;
+        levels[i].width = pl.width;
+        levels[i].height = pl.height;
+        levels[i].tiles_x = pl.tiles_x;
+        levels[i].mapped = file + pl.offset;
+        levels[i].mapped_size = pl.bytes;
+    }
+    levels_.swap(levels);
+    bytespp = t.bytespp;
+    layout = (Layout)t.layout;
+    format = (Format)t.format;
+    octahedral = t.octahedral;
+    tile_file.clear();
+    feedback_.clear();
+    return true;
+}
+
+// see "A Survey of Efficient Representations for Independent Unit Vectors", Cigolle et al. 2014
+void encode_octahedral(glm::dvec3 n, unsigned char* texel) {
+    glm::dvec2 p = glm::dvec2(n) / (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+    if (n.z < 0.0) {
+        glm::dvec2 sign(p.x >= 0.0 ? 1.0 : -1.0, p.y >= 0.0 ? 1.0 : -1.0);
+        p = (1.0 - glm::abs(glm::dvec2(p.y, p.x))) * sign;
+    }
+    for (int i = 0; i < 2; i++) {
+        short v = (short)std::lround(std::clamp(p[i], -1.0, 1.0) * 32767.0);
+        texel[2 * i] = v & 0xff;
+        texel[2 * i + 1] = (v >> 8) & 0xff;
+    }
+}
+
+glm::dvec3 decode_octahedral(const unsigned char* texel) {
+    glm::dvec2 p;
+    for (int i = 0; i < 2; i++) p[i] = (short)(texel[2 * i] | (texel[2 * i + 1] << 8)) / 32767.0;
+    glm::dvec3 n(p, 1.0 - std::abs(p.x) - std::abs(p.y));
+    if (n.z < 0.0) {
+        glm::dvec2 sign(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        n = glm::dvec3((1.0 - glm::abs(glm::dvec2(n.y, n.x))) * sign, n.z);
+    }
+    return glm::normalize(n);
+}
+
+Sampler::Sampler(Filter f) : filter(f) {
+}
+
+// bilinear filter of one level with texel centers at half-integer coordinates, clamped to the edges
+static void bilinear(Texture& tex, int level, glm::dvec2 uv, double* texel) {
+    int w = tex.get_width(level);
+    int h = tex.get_height(level);
+    double x = uv.x * w - 0.5;
+    double y = uv.y * h - 0.5;
+    double fx = std::floor(x);
+    double fy = std::floor(y);
+    double tx = x - fx;
+    double ty = y - fy;
+    int x0 = std::clamp((int)fx, 0, w - 1), x1 = std::clamp((int)fx + 1, 0, w - 1);
+    int y0 = std::clamp((int)fy, 0, h - 1), y1 = std::clamp((int)fy + 1, 0, h - 1);
+    double t00[max_texel_channels], t10[max_texel_channels], t01[max_texel_channels], t11[max_texel_channels];
+    tex.fetch(level, x0, y0, t00);
+    tex.fetch(level, x1, y0, t10);
+    tex.fetch(level, x0, y1, t01);
+    tex.fetch(level, x1, y1, t11);
+    for (int c = 0; c < tex.get_bytespp(); c++) {
+        double top = t00[c] + (t10[c] - t00[c]) * tx;
+        double bottom = t01[c] + (t11[c] - t01[c]) * tx;
+        texel[c] = top + (bottom - top) * ty;
+    }
+}
+
+void Sampler::sample(Texture& tex, glm::dvec2 uv, double lod, double* texel) const {
+    int n = tex.get_bytespp();
+    for (int c = 0; c < n; c++) texel[c] = 0.0;
+    if (!tex.levels()) return;
+
+    // point sampling of the full resolution level, texels outside the texture are black
+    if (filter == NEAREST) {
+        tex.fetch(0, (int)(uv.x * tex.get_width()), (int)(uv.y * tex.get_height()), texel);
+        return;
+    }
+
+    lod = std::clamp(lod, 0.0, static_cast<double>(tex.levels() - 1));
+    if (filter == BILINEAR) {
+        bilinear(tex, (int)std::floor(lod + 0.5), uv, texel);
+    }
+    else {
+        // trilinear: blend the two levels around lod
+        int level = (int)std::floor(lod);
+        double t = lod - level;
+        bilinear(tex, level, uv, texel);
+        if (t > 0.0 && level + 1 < tex.levels()) {
+            double next[max_texel_channels];
+            bilinear(tex, level + 1, uv, next);
+            for (int c = 0; c < n; c++) texel[c] += (next[c] - texel[c]) * t;
+        }
+    }
+
+    // filtered normals are shorter than unit
+    int k = tex.get_octahedral();
+    if (k >= 0) {
+        glm::dvec3 normal(texel[k], texel[k + 1], texel[k + 2]);
+        double len = glm::length(normal);
+        for (int c = 0; c < 3 && len > 1e-12; c++) texel[k + c] /= len;
+    }
+}
+
+TGAColor Sampler::sample(Texture& tex, glm::dvec2 uv, double lod) const {
+    double texel[max_texel_channels];
+    sample(tex, uv, lod, texel);
+    TGAColor color;
+    color.bytespp = std::min(tex.get_bytespp(), 4);
+    for (int c = 0; c < color.bytespp; c++) color[c] = (unsigned char)(texel[c] + 0.5);
+    return color;
+}
+
+// log2 of the longest screen axis footprint measured in level 0 texels
+double Sampler::lod(Texture& tex, glm::dmat2 duv) {
+    glm::dvec2 size(tex.get_width(), tex.get_height());
+    double rho = std::max(glm::length(duv[0] * size), glm::length(duv[1] * size));
+    return rho > 0.0 ? std::log2(rho) : 0.0;
+}
@@ -0,0 +1,97 @@
+#ifndef __TEXTURE_H__
+#define __TEXTURE_H__
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "tgaimage.h"
+
+const int max_texel_channels = 16;
+
+// one level of a mip chain, texels stored in the owning texture's layout
+struct TextureLevel {
+    int width;
+    int height;
+    int tiles_x; // tiles per row of the TILED layout, or 4x4 blocks per row of a compressed format
+    std::vector<unsigned char> data;
+    const unsigned char* mapped = nullptr; // texels viewed in memory the texture doesn't own, see Texture::unpack(). data is then empty
+    size_t mapped_size = 0;
+    std::vector<int> tile_slots; // sparse levels: slot of each tile in data, see Texture::open_tiles(). empty when fully resident
+    long long file_offset = 0;   // first tile of the level in the tile file
+};
+
+// texture with its full mip chain, level 0 being the source image
+class Texture {
+public:
+    enum Layout {
+        LINEAR, // row by row as in TGAImage
+        TILED   // 8x8 tiles row by row, Morton order inside a tile, so a 2D footprint stays within a few cache lines
+    };
+    enum Format {
+        RAW, // bytespp channels per texel, in the texture's layout
+        BC1, // 4x4 blocks of 8 bytes: two 565 colors and 2-bit indices, decodes to 3 channels
+        BC4, // 4x4 blocks of 8 bytes: two 8-bit values and 3-bit indices, decodes to 1 channel
+        BC5  // two BC4 blocks for red and green, decodes to 3 channels with blue rebuilt as the z of a unit normal
+    };
+protected:
+    std::vector<TextureLevel> levels_;
+    int bytespp; // channels of a decoded texel
+    Layout layout;
+    Format format;
+    int octahedral; // byte offset of an octahedral normal inside a RAW texel, -1 if none
+    std::string tile_file;           // backing file of a sparse texture, empty when every level is resident
+    std::vector<uint32_t> feedback_; // tiles fetched while not resident since the last resolve, level << 24 | tile
+    int texel_index(const TextureLevel& l, int x, int y); // -1 when the texel's tile is not resident
+public:
+    Texture();
+    void build(TGAImage& img, Layout layout = TILED);
+    void build(const unsigned char* data, int width, int height, int bytespp, Layout layout = TILED, int octahedral = -1); // data is row-major
+    int levels();
+    int get_width(int level = 0);
+    int get_height(int level = 0);
+    int get_bytespp();
+    Layout get_layout();
+    Format get_format();
+    int get_octahedral();
+    size_t size(); // bytes held by all levels
+    bool compress(Format f);
+    void drop_levels(int count); // the texture then starts at level count, the coarsest level is always kept
+    bool fetch(int level, int x, int y, double* texel); // decodes get_bytespp() channels, false outside the level
+    bool read_rows(int level, unsigned char* dst);      // row-major texels as build() takes them, RAW fully resident levels only
+
+    // virtual texturing: the tiles of every level are stored in a file and only the ones fetched are read back
+    bool write_tiles(const char* filename); // TILED RAW textures only
+    bool open_tiles(const char* filename);  // only the mip tail is read, the other levels start empty
+    bool sparse();
+    int feedback();         // tiles requested and not yet resident
+    int resolve_feedback(); // reads the requested tiles, returns how many were loaded
+
+    // asset packs: pack() appends the texture to a file image and returns where it starts, 0 for sparse textures.
+    // unpack() views the texels in place, the file memory has to outlive the texture
+    size_t pack(std::vector<unsigned char>& file);
+    bool unpack(const unsigned char* file, size_t file_size, size_t offset);
+};
+
+const size_t pack_alignment = 16;
+void pack_align(std::vector<unsigned char>& file); // pads the file image to pack_alignment
+
+// unit normals as two snorm16 in 4 bytes: the octahedron |x| + |y| + |z| = 1 unfolded onto a square
+void encode_octahedral(glm::dvec3 n, unsigned char* texel);
+glm::dvec3 decode_octahedral(const unsigned char* texel); // decodes to 3 channels, the 4th byte has no channel of its own
+
+// reads a texture with a filtering mode, lod being the log2 of the texel footprint of a pixel
+class Sampler {
+public:
+    enum Filter {
+        NEAREST, BILINEAR, TRILINEAR
+    };
+    Filter filter;
+
+    Sampler(Filter f = NEAREST);
+    void sample(Texture& tex, glm::dvec2 uv, double lod, double* texel) const; // texel receives get_bytespp() channels, up to max_texel_channels, octahedral normals come out as unit vectors
+    TGAColor sample(Texture& tex, glm::dvec2 uv, double lod) const;
+    static double lod(Texture& tex, glm::dmat2 duv); // duv columns are the uv derivatives along screen x and y
+};
+
+#endif //__TEXTURE_H__
@@ -0,0 +1,153 @@
+#include <iostream>
+#include <filesystem>
+#include "texture_cache.h"
+#include "thread_pool.h"
+#include "tgaimage.h"
+#include "mapped_file.h"
+
+const size_t default_texture_budget = 512u << 20;
+
+TextureCache::TextureCache() : lru_(), entries_(), pending_(), budget_(default_texture_budget) {
+}
+
+TextureCache& TextureCache::instance() {
+    static TextureCache cache;
+    return cache;
+}
+
+void TextureCache::set_budget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    budget_ = bytes;
+    evict();
+}
+
+size_t TextureCache::budget() {
+    return budget_;
+}
+
+size_t TextureCache::size() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes();
+}
+
+size_t TextureCache::bytes() {
+    size_t bytes = 0;
+    for (Entry& e : lru_) bytes += e.texture->size();
+    return bytes;
+}
+
+std::shared_ptr<Texture> TextureCache::get(const std::string& path, int level, bool sparse) {
+    std::string key = path + (sparse ? "#sparse#" : "#") + std::to_string(level);
+    return find_or_make(key, "texture file " + path, [&]() { return load(path, level, sparse); });
+}
+
+std::shared_ptr<Texture> TextureCache::get_variant(const std::shared_ptr<Texture>& source, const std::string& variant,
+    const std::function<std::shared_ptr<Texture>(const std::shared_ptr<Texture>& source)>& derive) {
+    std::string key;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (Entry& e : lru_) {
+            if (e.texture == source) {
+                key = e.key + "#" + variant;
+                break;
+            }
+        }
+    }
+    std::shared_ptr<Texture> texture = key.empty() ? derive(source) : find_or_make(key, "texture " + key, [&]() { return derive(source); });
+    return texture ? texture : source;
+}
+
+// the texture is made without holding the lock, so that other textures load meanwhile. nothing is cached when make
+// returns null
+std::shared_ptr<Texture> TextureCache::find_or_make(const std::string& key, const std::string& name, const std::function<std::shared_ptr<Texture>()>& make) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+        lru_.splice(lru_.begin(), lru_, it->second);
+        std::cerr << name << " cached" << std::endl;
+        return it->second->texture;
+    }
+    auto pending = pending_.find(key);
+    if (pending != pending_.end()) {
+        std::shared_future<std::shared_ptr<Texture>> loading = pending->second;
+        lock.unlock();
+        return loading.get();
+    }
+    std::promise<std::shared_ptr<Texture>> loaded;
+    pending_[key] = loaded.get_future().share();
+    lock.unlock();
+
+    std::shared_ptr<Texture> texture = make();
+    lock.lock();
+    if (texture) {
+        lru_.push_front(Entry{ key, texture });
+        entries_[key] = lru_.begin();
+    }
+    pending_.erase(key);
+    evict();
+    lock.unlock();
+    loaded.set_value(texture);
+    return texture;
+}
+
+std::shared_future<std::shared_ptr<Texture>> TextureCache::get_async(const std::string& path, int level, bool sparse) {
+    std::shared_ptr<std::promise<std::shared_ptr<Texture>>> result = std::make_shared<std::promise<std::shared_ptr<Texture>>>();
+    std::shared_future<std::shared_ptr<Texture>> texture = result->get_future().share();
+    ThreadPool::instance().submit([this, path, level, sparse, result]() { result->set_value(get(path, level, sparse)); });
+    return texture;
+}
+
+void TextureCache::trim() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    evict();
+}
+
+// sizes are taken again on every trim, textures grow as sparse tiles are resolved
+void TextureCache::evict() {
+    size_t bytes = this->bytes();
+    for (auto it = lru_.end(); it != lru_.begin() && bytes > budget_;) {
+        --it;
+        if (it->texture.use_count() > 1) continue; // still held by a model, evicting it would free nothing
+        bytes -= it->texture->size();
+        entries_.erase(it->key);
+        it = lru_.erase(it);
+    }
+}
+
+void TextureCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    lru_.clear();
+}
+
+// loads the image bottom row first so that v grows upwards, then builds its mip chain.
+// a sparse texture is opened from the .tiles file next to the image instead, baked from the image when it is
+// missing or older, so that later runs never decode the whole image
+std::shared_ptr<Texture> TextureCache::load(const std::string& path, int level, bool sparse) {
+    std::shared_ptr<Texture> tex = std::make_shared<Texture>();
+    std::string tilefile = path.substr(0, path.find_last_of(".")) + ".tiles";
+    bool opened = false;
+    if (sparse) {
+        std::error_code ec;
+        bool fresh = std::filesystem::exists(tilefile, ec) &&
+            std::filesystem::last_write_time(tilefile, ec) >= std::filesystem::last_write_time(path, ec);
+        opened = fresh && tex->open_tiles(tilefile.c_str());
+        if (opened) std::cerr << "texture file " << tilefile << " opened, " << tex->size() / 1024 << "KB resident" << std::endl;
+    }
+    if (!opened) {
+        // decoded straight into the buffer the mip chain is built from
+        MappedFile file;
+        std::vector<unsigned char> pixels;
+        int width = 0, height = 0, bytespp = 0;
+        bool ok = file.open(path.c_str()) && TGAImage::read_tga_header(file.data(), file.size(), width, height, bytespp);
+        if (ok) {
+            pixels.resize((size_t)width * height * bytespp);
+            ok = TGAImage::decode_tga(file.data(), file.size(), pixels.data(), (long)width * bytespp, true);
+        }
+        std::cerr << "texture file " << path << " loading " << (ok ? "ok" : "failed") << std::endl;
+        if (ok) tex->build(pixels.data(), width, height, bytespp);
+        if (sparse && tex->levels() && tex->write_tiles(tilefile.c_str())) tex->open_tiles(tilefile.c_str());
+    }
+    tex->drop_levels(level);
+    return tex;
+}
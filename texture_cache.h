@@ -0,0 +1,50 @@
+#ifndef __TEXTURE_CACHE_H__
+#define __TEXTURE_CACHE_H__
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <future>
+#include <functional>
+#include "texture.h"
+
+// process-wide cache of the textures loaded from image files, keyed by path and the mip level they start at,
+// so that models sharing a map load it once. textures that fall out of the memory budget are released least
+// recently used first, as soon as no model holds them anymore. safe to use from several threads, a texture
+// requested while it is being loaded is waited for rather than loaded twice.
+class TextureCache {
+private:
+    struct Entry {
+        std::string key;
+        std::shared_ptr<Texture> texture;
+    };
+    std::list<Entry> lru_; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> entries_;
+    std::unordered_map<std::string, std::shared_future<std::shared_ptr<Texture>>> pending_; // loads in progress
+    size_t budget_;
+    std::mutex mutex_;
+    TextureCache();
+    std::shared_ptr<Texture> load(const std::string& path, int level, bool sparse);
+    std::shared_ptr<Texture> find_or_make(const std::string& key, const std::string& name, const std::function<std::shared_ptr<Texture>()>& make);
+    size_t bytes();
+    void evict();
+
+public:
+    static TextureCache& instance();
+    void set_budget(size_t bytes);
+    size_t budget();
+    size_t size(); // bytes held by the cached textures, including the ones in use
+    std::shared_ptr<Texture> get(const std::string& path, int level = 0, bool sparse = false); // never null, empty when the file can't be read
+    std::shared_future<std::shared_ptr<Texture>> get_async(const std::string& path, int level = 0, bool sparse = false); // get() on the thread pool
+    // texture made from a cached one by derive, cached in turn under the source's key followed by variant, so that
+    // the source stays as it is for everyone sharing it. sources the cache doesn't hold are derived on every call.
+    // derive returns null when there is no such variant of the source, which is then returned itself
+    std::shared_ptr<Texture> get_variant(const std::shared_ptr<Texture>& source, const std::string& variant,
+        const std::function<std::shared_ptr<Texture>(const std::shared_ptr<Texture>& source)>& derive);
+    void trim(); // evicts unused textures until the cache fits its budget
+    void clear();
+};
+
+#endif //__TEXTURE_CACHE_H__
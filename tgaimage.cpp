@@ -3,7 +3,19 @@
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#include <algorithm>
+#include <string>
+#include <cstdint>
+#include <ctype.h>
 #include "tgaimage.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0) {
 }
@@ -20,6 +32,11 @@ TGAImage::TGAImage(const TGAImage& img) : data(NULL), width(img.width), height(i
     memcpy(data, img.data, nbytes);
 }
 
+TGAImage::TGAImage(TGAImage&& img) : data(img.data), width(img.width), height(img.height), bytespp(img.bytespp) {
+    img.data = NULL;
+    img.width = img.height = img.bytespp = 0;
+}
+
 TGAImage::~TGAImage() {
     if (data) delete[] data;
 }
@@ -37,118 +54,128 @@ TGAImage& TGAImage::operator =(const TGAImage& img) {
     return *this;
 }
 
-bool TGAImage::read_tga_file(const char* filename) {
+TGAImage& TGAImage::operator =(TGAImage&& img) {
+    if (this != &img) {
+        if (data) delete[] data;
+        data = img.data;
+        width = img.width;
+        height = img.height;
+        bytespp = img.bytespp;
+        img.data = NULL;
+        img.width = img.height = img.bytespp = 0;
+    }
+    return *this;
+}
+
+// the file is mapped and decoded in place
+bool TGAImage::read_tga_file(const char* filename, bool bottom_up) {
     if (data) delete[] data;
     data = NULL;
-    std::ifstream in;
-    in.open(filename, std::ios::binary);
-    if (!in.is_open()) {
+    MappedFile file;
+    if (!file.open(filename)) {
         std::cerr << "can't open file " << filename << "\n";
-        in.close();
         return false;
     }
+    if (!read_tga_header(file.data(), file.size(), width, height, bytespp)) return false;
+    data = new unsigned char[(unsigned long)width * height * bytespp];
+    if (!decode_tga(file.data(), file.size(), data, (long)width * bytespp, bottom_up)) return false;
+    std::cerr << width << "x" << height << "/" << bytespp * 8 << "\n";
+    return true;
+}
+
+bool TGAImage::read_tga_header(const unsigned char* file, size_t size, int& width, int& height, int& bytespp) {
     TGA_Header header;
-    in.read((char*)&header, sizeof(header));
-    if (!in.good()) {
-        in.close();
+    if (size < sizeof(header)) {
         std::cerr << "an error occured while reading the header\n";
         return false;
     }
+    memcpy(&header, file, sizeof(header));
     width = header.width;
     height = header.height;
     bytespp = header.bitsperpixel >> 3;
     if (width <= 0 || height <= 0 || (bytespp != GRAYSCALE && bytespp != RGB && bytespp != RGBA)) {
-        in.close();
         std::cerr << "bad bpp (or width/height) value\n";
         return false;
     }
-    unsigned long nbytes = bytespp * width * height;
-    data = new unsigned char[nbytes];
-    if (3 == header.datatypecode || 2 == header.datatypecode) {
-        in.read((char*)data, nbytes);
-        if (!in.good()) {
-            in.close();
-            std::cerr << "an error occured while reading the data\n";
-            return false;
-        }
-    }
-    else if (10 == header.datatypecode || 11 == header.datatypecode) {
-        if (!load_rle_data(in)) {
-            in.close();
-            std::cerr << "an error occured while reading the data\n";
-            return false;
-        }
-    }
-    else {
-        in.close();
+    if (header.datatypecode != 2 && header.datatypecode != 3 && header.datatypecode != 10 && header.datatypecode != 11) {
         std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
         return false;
     }
-    if (!(header.imagedescriptor & 0x20)) {
-        flip_vertically();
-    }
-    if (header.imagedescriptor & 0x10) {
-        flip_horizontally();
-    }
-    std::cerr << width << "x" << height << "/" << bytespp * 8 << "\n";
-    in.close();
     return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream& in) {
-    unsigned long pixelcount = width * height;
-    unsigned long currentpixel = 0;
-    unsigned long currentbyte = 0;
-    TGAColor colorbuffer;
-    do {
-        unsigned char chunkheader = 0;
-        chunkheader = in.get();
-        if (!in.good()) {
-            std::cerr << "an error occured while reading the data\n";
-            return false;
-        }
-        if (chunkheader < 128) {
-            chunkheader++;
-            for (int i = 0; i < chunkheader; i++) {
-                in.read((char*)colorbuffer.bgra, bytespp);
-                if (!in.good()) {
-                    std::cerr << "an error occured while reading the header\n";
-                    return false;
-                }
-                for (int t = 0; t < bytespp; t++)
-                    data[currentbyte++] = colorbuffer.bgra[t];
-                currentpixel++;
-                if (currentpixel > pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
-            }
+// rows are written straight to where they end up, whatever order the file stores them in. raw data is copied a
+// row segment at a time, run-length packets are filled by doubling the copied pixel
+bool TGAImage::decode_tga(const unsigned char* file, size_t size, unsigned char* dst, long stride, bool bottom_up) {
+    int width, height, bytespp;
+    if (!read_tga_header(file, size, width, height, bytespp)) return false;
+    TGA_Header header;
+    memcpy(&header, file, sizeof(header));
+    size_t pos = sizeof(header) + (unsigned char)header.idlength;
+    if (header.colormaptype) pos += (size_t)(unsigned short)header.colormaplength * (((unsigned char)header.colormapdepth + 7) >> 3);
+    bool top_first = (header.imagedescriptor & 0x20) != 0;
+    bool rle = header.datatypecode == 10 || header.datatypecode == 11;
+
+    // file row r in the destination
+    auto row = [&](int r) {
+        int y = top_first ? r : height - 1 - r; // from the top
+        return dst + (bottom_up ? height - 1 - y : y) * stride;
+    };
+    int r = 0, x = 0;
+    while (r < height) {
+        bool run = false;
+        int count = width - x;
+        if (rle) {
+            if (pos >= size) break;
+            unsigned char packet = file[pos++];
+            run = packet & 0x80;
+            count = (packet & 0x7f) + 1;
         }
-        else {
-            chunkheader -= 127;
-            in.read((char*)colorbuffer.bgra, bytespp);
-            if (!in.good()) {
-                std::cerr << "an error occured while reading the header\n";
+        size_t packet_bytes = (size_t)(run ? 1 : count) * bytespp;
+        if (pos + packet_bytes > size) break;
+        const unsigned char* src = file + pos;
+        pos += packet_bytes;
+        while (count > 0) {
+            if (r == height) {
+                std::cerr << "Too many pixels read\n";
                 return false;
             }
-            for (int i = 0; i < chunkheader; i++) {
-                for (int t = 0; t < bytespp; t++)
-                    data[currentbyte++] = colorbuffer.bgra[t];
-                currentpixel++;
-                if (currentpixel > pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
+            int n = std::min(count, width - x);
+            unsigned char* out = row(r) + (long)x * bytespp;
+            long bytes = (long)n * bytespp;
+            if (!run) {
+                memcpy(out, src, bytes);
+                src += bytes;
+            }
+            else if (bytespp == 1) {
+                memset(out, src[0], bytes);
+            }
+            else {
+                memcpy(out, src, bytespp);
+                for (long filled = bytespp; filled < bytes; filled *= 2) memcpy(out + filled, out, std::min(filled, bytes - filled));
+            }
+            count -= n;
+            x += n;
+            if (x == width) {
+                x = 0;
+                r++;
             }
         }
-    } while (currentpixel < pixelcount);
+    }
+    if (r < height) {
+        std::cerr << "an error occured while reading the data\n";
+        return false;
+    }
+    if (header.imagedescriptor & 0x10) {
+        for (int y = 0; y < height; y++) {
+            unsigned char* line = dst + y * stride;
+            for (int a = 0, b = width - 1; a < b; a++, b--) std::swap_ranges(line + a * bytespp, line + (a + 1) * bytespp, line + b * bytespp);
+        }
+    }
     return true;
 }
 
-bool TGAImage::write_tga_file(const char* filename, bool rle) {
-    unsigned char developer_area_ref[4] = { 0, 0, 0, 0 };
-    unsigned char extension_area_ref[4] = { 0, 0, 0, 0 };
-    unsigned char footer[18] = { 'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0' };
+static bool write_bytes(const char* filename, const std::vector<unsigned char>& file) {
     std::ofstream out;
     out.open(filename, std::ios::binary);
     if (!out.is_open()) {
@@ -156,6 +183,21 @@ bool TGAImage::write_tga_file(const char* filename, bool rle) {
         out.close();
         return false;
     }
+    out.write((const char*)file.data(), file.size());
+    if (!out.good()) {
+        std::cerr << "can't dump the file " << filename << "\n";
+        out.close();
+        return false;
+    }
+    out.close();
+    return true;
+}
+
+// the whole file is assembled in memory and written at once
+bool TGAImage::write_tga_file(const char* filename, bool rle) {
+    unsigned char developer_area_ref[4] = { 0, 0, 0, 0 };
+    unsigned char extension_area_ref[4] = { 0, 0, 0, 0 };
+    unsigned char footer[18] = { 'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0' };
     TGA_Header header;
     memset((void*)&header, 0, sizeof(header));
     header.bitsperpixel = bytespp << 3;
@@ -163,92 +205,342 @@ bool TGAImage::write_tga_file(const char* filename, bool rle) {
     header.height = height;
     header.datatypecode = (bytespp == GRAYSCALE ? (rle ? 11 : 3) : (rle ? 10 : 2));
     header.imagedescriptor = 0x20; // top-left origin
-    out.write((char*)&header, sizeof(header));
-    if (!out.good()) {
-        out.close();
-        std::cerr << "can't dump the tga file\n";
-        return false;
+    std::vector<unsigned char> file((unsigned char*)&header, (unsigned char*)&header + sizeof(header));
+    if (!rle) file.insert(file.end(), data, data + (unsigned long)width * height * bytespp);
+    else encode_rle_data(file);
+    file.insert(file.end(), developer_area_ref, developer_area_ref + sizeof(developer_area_ref));
+    file.insert(file.end(), extension_area_ref, extension_area_ref + sizeof(extension_area_ref));
+    file.insert(file.end(), footer, footer + sizeof(footer));
+
+    return write_bytes(filename, file);
+}
+
+#if defined(__SSE2__) || defined(_M_X64)
+static const unsigned pixel_starts[5] = { 0, 0xffff, 0x5555, 0x1249, 0x1111 }; // first byte of each pixel whole in 16 bytes
+
+// bit q * bytespp set when pixel q equals pixel q + 1, for the pixels lying whole in 16 bytes from p.
+// reads 16 + bytespp bytes
+static unsigned pair_mask(const unsigned char* p, int bytespp) {
+    __m128i a = _mm_loadu_si128((const __m128i*)p);
+    __m128i b = _mm_loadu_si128((const __m128i*)(p + bytespp));
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+    unsigned pixels = mask;
+    for (int t = 1; t < bytespp; t++) pixels &= mask >> t;
+    return pixels & pixel_starts[bytespp];
+}
+
+static int lowest_bit(unsigned mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+// first pixel q in [from, to) that equals pixel q + 1 if equal is set, or differs from it otherwise, to when there is none.
+// 16 bytes are compared at once while they stay inside the image, which ends at end
+static int find_pair(const unsigned char* row, int from, int to, int bytespp, bool equal, const unsigned char* end) {
+    int q = from;
+#if defined(__SSE2__) || defined(_M_X64)
+    int window = 16 / bytespp;
+    while (q + window <= to && row + (q * bytespp) + 16 + bytespp <= end) {
+        unsigned mask = pair_mask(row + q * bytespp, bytespp);
+        if (!equal) mask = ~mask & pixel_starts[bytespp];
+        if (mask) return q + lowest_bit(mask) / bytespp;
+        q += window;
+    }
+#endif
+    for (; q < to; q++) {
+        if ((memcmp(row + q * bytespp, row + (q + 1) * bytespp, bytespp) == 0) == equal) return q;
     }
-    if (!rle) {
-        out.write((char*)data, width * height * bytespp);
-        if (!out.good()) {
-            std::cerr << "can't unload raw data\n";
-            out.close();
-            return false;
+    return to;
+}
+
+// packets of one row, never crossing into the next one: runs of up to 128 equal pixels, raw packets of up to
+// 128 pixels in between, stopping where two equal pixels start a run
+static void encode_rle_row(const unsigned char* row, int width, int bytespp, const unsigned char* end, std::vector<unsigned char>& out) {
+    const int max_chunk_length = 128;
+    int p = 0;
+    while (p < width) {
+        if (p + 1 < width && !memcmp(row + p * bytespp, row + (p + 1) * bytespp, bytespp)) {
+            int last = find_pair(row, p, std::min(width - 1, p + max_chunk_length - 1), bytespp, false, end);
+            int length = last - p + 1;
+            out.push_back((unsigned char)(length + 127));
+            out.insert(out.end(), row + p * bytespp, row + (p + 1) * bytespp);
+            p += length;
+        }
+        else {
+            int limit = std::min(width - 1, p + max_chunk_length);
+            int next = find_pair(row, p + 1, limit, bytespp, true, end);
+            int length = next == limit ? std::min(width, p + max_chunk_length) - p : next - p;
+            out.push_back((unsigned char)(length - 1));
+            out.insert(out.end(), row + p * bytespp, row + (p + length) * bytespp);
+            p += length;
         }
     }
+}
+
+// bands of rows are encoded on the thread pool into buffers of their own, then appended in order.
+// bands don't depend on the number of threads, so neither does the output
+void TGAImage::encode_rle_data(std::vector<unsigned char>& out) {
+    const int band_rows = 16;
+    int bands = (height + band_rows - 1) / band_rows;
+    std::vector<std::vector<unsigned char>> encoded(bands);
+    const unsigned char* end = data + (unsigned long)width * height * bytespp;
+    ThreadPool::instance().parallel_for(bands, [&](int band) {
+        std::vector<unsigned char>& buffer = encoded[band];
+        buffer.reserve((size_t)width * band_rows * bytespp / 4);
+        for (int y = band * band_rows; y < std::min(height, (band + 1) * band_rows); y++) {
+            encode_rle_row(data + (unsigned long)y * width * bytespp, width, bytespp, end, buffer);
+        }
+    });
+    size_t total = out.size();
+    for (std::vector<unsigned char>& buffer : encoded) total += buffer.size();
+    out.reserve(total);
+    for (std::vector<unsigned char>& buffer : encoded) out.insert(out.end(), buffer.begin(), buffer.end());
+}
+
+// the extension is compared without regard to case, anything unknown is written as tga
+bool TGAImage::write_file(const char* filename) {
+    std::string name(filename);
+    size_t dot = name.find_last_of(".");
+    std::string ext = dot == std::string::npos ? "" : name.substr(dot + 1);
+    for (char& c : ext) c = (char)tolower((unsigned char)c);
+    if (ext == "qoi") return write_qoi_file(filename);
+    if (ext == "ppm") return write_pnm_file(filename, false);
+    if (ext == "pgm") return write_pnm_file(filename, true);
+    if (ext == "pfm") return write_pfm_file(filename);
+    return write_tga_file(filename);
+}
+
+// rgba of pixel i, grayscale spread over the three colors
+static inline void pixel_rgba(const unsigned char* data, int bytespp, long i, unsigned char px[4]) {
+    const unsigned char* p = data + i * bytespp;
+    if (bytespp == TGAImage::GRAYSCALE) {
+        px[0] = px[1] = px[2] = p[0];
+        px[3] = 255;
+    }
     else {
-        if (!unload_rle_data(out)) {
-            out.close();
-            std::cerr << "can't unload rle data\n";
-            return false;
+        px[0] = p[2];
+        px[1] = p[1];
+        px[2] = p[0];
+        px[3] = bytespp == TGAImage::RGBA ? p[3] : 255;
+    }
+}
+
+static inline int qoi_hash(const unsigned char px[4]) {
+    return (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) & 63;
+}
+
+static const unsigned char qoi_end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+// qoi, see qoiformat.org: each pixel is a run of the previous one, a slot of the 64 recently seen, a small
+// difference from the previous one, or given in full. grayscale images are written as rgb
+bool TGAImage::write_qoi_file(const char* filename) {
+    if (!data) return false;
+    int channels = bytespp == RGBA ? 4 : 3;
+    long npixels = (long)width * height;
+    std::vector<unsigned char> file(14 + npixels * (channels + 1) + sizeof(qoi_end)); // every pixel given in full
+    unsigned char* out = file.data();
+    memcpy(out, "qoif", 4);
+    for (int b = 0; b < 4; b++) {
+        out[4 + b] = (unsigned char)(width >> (24 - 8 * b));
+        out[8 + b] = (unsigned char)(height >> (24 - 8 * b));
+    }
+    out[12] = (unsigned char)channels;
+    out[13] = 0; // srgb with linear alpha
+    out += 14;
+
+    unsigned char seen[64][4];
+    memset(seen, 0, sizeof(seen));
+    unsigned char prev[4] = { 0, 0, 0, 255 };
+    unsigned char px[4];
+    int run = 0;
+    for (long i = 0; i < npixels; i++) {
+        pixel_rgba(data, bytespp, i, px);
+        if (!memcmp(px, prev, 4)) {
+            if (++run == 62 || i == npixels - 1) {
+                *out++ = 0xc0 | (run - 1);
+                run = 0;
+            }
+            continue;
+        }
+        if (run) {
+            *out++ = 0xc0 | (run - 1);
+            run = 0;
+        }
+        int h = qoi_hash(px);
+        if (!memcmp(seen[h], px, 4)) {
+            *out++ = (unsigned char)h;
         }
+        else {
+            memcpy(seen[h], px, 4);
+            if (px[3] == prev[3]) {
+                signed char dr = (signed char)(px[0] - prev[0]);
+                signed char dg = (signed char)(px[1] - prev[1]);
+                signed char db = (signed char)(px[2] - prev[2]);
+                int dr_dg = dr - dg, db_dg = db - dg;
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                    *out++ = 0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+                }
+                else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+                    *out++ = 0x80 | (dg + 32);
+                    *out++ = (dr_dg + 8) << 4 | (db_dg + 8);
+                }
+                else {
+                    *out++ = 0xfe;
+                    memcpy(out, px, 3);
+                    out += 3;
+                }
+            }
+            else {
+                *out++ = 0xff;
+                memcpy(out, px, 4);
+                out += 4;
+            }
+        }
+        memcpy(prev, px, 4);
     }
-    out.write((char*)developer_area_ref, sizeof(developer_area_ref));
-    if (!out.good()) {
-        std::cerr << "can't dump the tga file\n";
-        out.close();
+    memcpy(out, qoi_end, sizeof(qoi_end));
+    out += sizeof(qoi_end);
+    file.resize(out - file.data());
+    return write_bytes(filename, file);
+}
+
+// 3 channel files give an rgb image, 4 channel ones an rgba image. stops at the end of the data, leaving the pixels
+// not reached black
+bool TGAImage::read_qoi_file(const char* filename) {
+    if (data) delete[] data;
+    data = NULL;
+    MappedFile file;
+    if (!file.open(filename)) {
+        std::cerr << "can't open file " << filename << "\n";
         return false;
     }
-    out.write((char*)extension_area_ref, sizeof(extension_area_ref));
-    if (!out.good()) {
-        std::cerr << "can't dump the tga file\n";
-        out.close();
+    const unsigned char* q = file.data();
+    size_t size = file.size();
+    if (size < 14 + sizeof(qoi_end) || memcmp(q, "qoif", 4)) {
+        std::cerr << "not a qoi file " << filename << "\n";
         return false;
     }
-    out.write((char*)footer, sizeof(footer));
-    if (!out.good()) {
-        std::cerr << "can't dump the tga file\n";
-        out.close();
+    unsigned w = (unsigned)q[4] << 24 | q[5] << 16 | q[6] << 8 | q[7];
+    unsigned h = (unsigned)q[8] << 24 | q[9] << 16 | q[10] << 8 | q[11];
+    int channels = q[12];
+    if (!w || !h || w > 32767 || h > 32767 || (channels != 3 && channels != 4)) {
+        std::cerr << "bad qoi channels (or width/height) value\n";
         return false;
     }
-    out.close();
-    return true;
-}
+    width = w;
+    height = h;
+    bytespp = channels == 4 ? RGBA : RGB;
+    long npixels = (long)width * height;
+    data = new unsigned char[npixels * bytespp];
+    memset(data, 0, npixels * bytespp);
 
-// TODO: it is not necessary to break a raw chunk for two equal pixels (for the matter of the resulting size)
-bool TGAImage::unload_rle_data(std::ofstream& out) {
-    const unsigned char max_chunk_length = 128;
-    unsigned long npixels = width * height;
-    unsigned long curpix = 0;
-    while (curpix < npixels) {
-        unsigned long chunkstart = curpix * bytespp;
-        unsigned long curbyte = curpix * bytespp;
-        unsigned char run_length = 1;
-        bool raw = true;
-        while (curpix + run_length < npixels && run_length < max_chunk_length) {
-            bool succ_eq = true;
-            for (int t = 0; succ_eq && t < bytespp; t++) {
-                succ_eq = (data[curbyte + t] == data[curbyte + t + bytespp]);
+    unsigned char seen[64][4];
+    memset(seen, 0, sizeof(seen));
+    unsigned char px[4] = { 0, 0, 0, 255 };
+    size_t pos = 14, end = size - sizeof(qoi_end);
+    int run = 0;
+    for (long i = 0; i < npixels; i++) {
+        if (run) {
+            run--;
+        }
+        else {
+            if (pos >= end) break;
+            unsigned char op = q[pos++];
+            if (op == 0xfe) {
+                if (pos + 3 > end) break;
+                memcpy(px, q + pos, 3);
+                pos += 3;
             }
-            curbyte += bytespp;
-            if (1 == run_length) {
-                raw = !succ_eq;
+            else if (op == 0xff) {
+                if (pos + 4 > end) break;
+                memcpy(px, q + pos, 4);
+                pos += 4;
             }
-            if (raw && succ_eq) {
-                run_length--;
-                break;
+            else if ((op & 0xc0) == 0x00) {
+                memcpy(px, seen[op], 4);
             }
-            if (!raw && !succ_eq) {
-                break;
+            else if ((op & 0xc0) == 0x40) {
+                px[0] += ((op >> 4) & 3) - 2;
+                px[1] += ((op >> 2) & 3) - 2;
+                px[2] += (op & 3) - 2;
             }
-            run_length++;
-        }
-        curpix += run_length;
-        out.put(raw ? run_length - 1 : run_length + 127);
-        if (!out.good()) {
-            std::cerr << "can't dump the tga file\n";
-            return false;
-        }
-        out.write((char*)(data + chunkstart), (raw ? run_length * bytespp : bytespp));
-        if (!out.good()) {
-            std::cerr << "can't dump the tga file\n";
-            return false;
+            else if ((op & 0xc0) == 0x80) {
+                if (pos >= end) break;
+                int dg = (op & 0x3f) - 32;
+                unsigned char b = q[pos++];
+                px[0] += dg - 8 + (b >> 4);
+                px[1] += dg;
+                px[2] += dg - 8 + (b & 0x0f);
+            }
+            else {
+                run = op & 0x3f;
+            }
+            memcpy(seen[qoi_hash(px)], px, 4);
         }
+        unsigned char* p = data + i * bytespp;
+        p[0] = px[2];
+        p[1] = px[1];
+        p[2] = px[0];
+        if (bytespp == RGBA) p[3] = px[3];
     }
+    std::cerr << width << "x" << height << "/" << bytespp * 8 << "\n";
     return true;
 }
 
+// binary portable maps, top row first. alpha is dropped, colors are reduced to their luma for pgm
+bool TGAImage::write_pnm_file(const char* filename, bool gray) {
+    if (!data) return false;
+    std::string header = std::string(gray ? "P5\n" : "P6\n") + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+    int channels = gray ? 1 : 3;
+    std::vector<unsigned char> file(header.begin(), header.end());
+    file.resize(header.size() + (size_t)width * height * channels);
+    unsigned char* dst = file.data() + header.size();
+    unsigned char px[4];
+    for (long i = 0; i < (long)width * height; i++) {
+        pixel_rgba(data, bytespp, i, px);
+        if (gray) dst[i] = (unsigned char)((px[0] * 77 + px[1] * 150 + px[2] * 29 + 128) >> 8);
+        else memcpy(dst + i * 3, px, 3);
+    }
+    return write_bytes(filename, file);
+}
+
+// the 8 bit values scaled to [0, 1]: grayscale images give a one channel map, the others an rgb one
+bool TGAImage::write_pfm_file(const char* filename) {
+    if (!data) return false;
+    int channels = bytespp == GRAYSCALE ? 1 : 3;
+    std::vector<float> values((size_t)width * height * channels);
+    unsigned char px[4];
+    for (long i = 0; i < (long)width * height; i++) {
+        pixel_rgba(data, bytespp, i, px);
+        for (int c = 0; c < channels; c++) values[i * channels + c] = px[c] / 255.f;
+    }
+    return write_pfm_file(filename, values.data(), width, height, channels);
+}
+
+// pfm stores the bottom row first, little endian as the negative scale says
+bool TGAImage::write_pfm_file(const char* filename, const float* values, int width, int height, int channels) {
+    std::string header = std::string(channels == 1 ? "Pf\n" : "PF\n") + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n";
+    std::vector<unsigned char> file(header.begin(), header.end());
+    size_t row_bytes = (size_t)width * channels * sizeof(float);
+    file.resize(header.size() + row_bytes * height);
+    for (int y = 0; y < height; y++) {
+        unsigned char* dst = file.data() + header.size() + (size_t)(height - 1 - y) * row_bytes;
+        const float* src = values + (size_t)y * width * channels;
+        for (size_t k = 0; k < (size_t)width * channels; k++) {
+            uint32_t bits;
+            memcpy(&bits, src + k, 4);
+            for (int b = 0; b < 4; b++) dst[k * 4 + b] = (unsigned char)(bits >> (8 * b));
+        }
+    }
+    return write_bytes(filename, file);
+}
+
 TGAColor TGAImage::get(int x, int y) {
     if (!data || x < 0 || y < 0 || x >= width || y >= height) {
         return TGAColor();
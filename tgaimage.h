@@ -2,6 +2,7 @@
 #define __IMAGE_H__
 
 #include <fstream>
+#include <vector>
 
 #pragma pack(push,1)
 struct TGA_Header {
@@ -70,8 +71,7 @@ protected:
     int height;
     int bytespp;
 
-    bool   load_rle_data(std::ifstream& in);
-    bool unload_rle_data(std::ofstream& out);
+    void encode_rle_data(std::vector<unsigned char>& out); // appends the pixels as rle packets
 public:
     enum Format {
         GRAYSCALE = 1, RGB = 3, RGBA = 4
@@ -80,8 +80,20 @@ public:
     TGAImage();
     TGAImage(int w, int h, int bpp);
     TGAImage(const TGAImage& img);
-    bool read_tga_file(const char* filename);
+    TGAImage(TGAImage&& img); // takes the pixels, leaving img empty
+    bool read_tga_file(const char* filename, bool bottom_up = false); // bottom_up stores the bottom row first
+    // tga file images in memory: the header is checked against the file size, then the pixels are decoded left to
+    // right into dst, stride bytes apart from one row to the next, top row first unless bottom_up
+    static bool read_tga_header(const unsigned char* file, size_t size, int& width, int& height, int& bytespp);
+    static bool decode_tga(const unsigned char* file, size_t size, unsigned char* dst, long stride, bool bottom_up = false);
     bool write_tga_file(const char* filename, bool rle = true);
+    bool write_file(const char* filename); // format from the extension: .qoi, .ppm, .pgm, .pfm, otherwise tga
+    bool read_qoi_file(const char* filename);
+    bool write_qoi_file(const char* filename);
+    bool write_pnm_file(const char* filename, bool gray); // binary pgm if gray, ppm otherwise
+    bool write_pfm_file(const char* filename);
+    // float maps of 1 or 3 channels, top row first, without any quantization
+    static bool write_pfm_file(const char* filename, const float* values, int width, int height, int channels);
     bool flip_horizontally();
     bool flip_vertically();
     bool scale(int w, int h);
@@ -90,6 +102,7 @@ public:
     bool set(int x, int y, const TGAColor& c);
     ~TGAImage();
     TGAImage& operator =(const TGAImage& img);
+    TGAImage& operator =(TGAImage&& img);
     int get_width();
     int get_height();
     int get_bytespp();
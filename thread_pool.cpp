@@ -0,0 +1,78 @@
+#include <atomic>
+#include <algorithm>
+#include <memory>
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(int threads) : workers_(), tasks_(), mutex_(), wake_(), stopping_(false) {
+    for (int i = 0; i < threads; i++) workers_.emplace_back(&ThreadPool::work, this);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& t : workers_) t.join();
+}
+
+ThreadPool& ThreadPool::instance() {
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+    return pool;
+}
+
+int ThreadPool::size() {
+    return (int)workers_.size();
+}
+
+void ThreadPool::work() {
+    while (true) {
+        std::packaged_task<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) return;
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+std::future<void> ThreadPool::submit(std::function<void()> task) {
+    std::packaged_task<void()> packaged(std::move(task));
+    std::future<void> done = packaged.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(packaged));
+    }
+    wake_.notify_one();
+    return done;
+}
+
+// indices are handed out one at a time from a shared counter. helpers starting after every index is taken
+// find nothing left to do, they only keep the shared state alive
+void ThreadPool::parallel_for(int n, const std::function<void(int)>& body) {
+    if (n <= 0) return;
+    struct State {
+        std::atomic<int> next{ 0 };
+        std::atomic<int> done{ 0 };
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    const std::function<void(int)>* f = &body;
+    auto run = [state, n, f]() {
+        for (int i = state->next++; i < n; i = state->next++) {
+            (*f)(i);
+            if (++state->done == n) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->finished.notify_all();
+            }
+        }
+    };
+    for (int i = 0; i < std::min(n - 1, size()); i++) submit(run);
+    run();
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&] { return state->done == n; });
+}
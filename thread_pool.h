@@ -0,0 +1,33 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+
+// fixed set of worker threads running queued tasks in submission order
+class ThreadPool {
+private:
+    std::vector<std::thread> workers_;
+    std::deque<std::packaged_task<void()> > tasks_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_;
+    void work();
+
+public:
+    ThreadPool(int threads);
+    ~ThreadPool(); // finishes the queued tasks first
+    static ThreadPool& instance(); // one worker per hardware thread
+    int size();
+    std::future<void> submit(std::function<void()> task);
+    // calls body(0) .. body(n - 1) across the workers and the calling thread, returns once all are done.
+    // the calling thread takes part, so it can't deadlock behind tasks queued before it
+    void parallel_for(int n, const std::function<void(int)>& body);
+};
+
+#endif //__THREAD_POOL_H__